@@ -4,10 +4,40 @@
 //  FILE NAME: ModelLoader.cpp
 //
 //  Press key '1' to toggle 90 degs model rotation about x-axis on/off.
+//  Press key 'k' to cycle through the skinning kernels supported by the CPU.
+//  Press key 'b' to switch between baked and keyframed poses (with --bake).
+//  Press key 'g' to switch between CPU and vertex shader skinning.
+//  Press key 'c' to toggle a crowd of the current character, '+'/'-' to resize it.
+//  Press key 'p' to pause/resume the animation clock.
+//  Press key 'f' to print the frame cache counters (with --frame-cache).
+//  Press key 'v' to switch frustum culling of meshes and crowd instances on/off.
+//  Press key 'l' to switch level of detail selection on/off.
+//  Press key 'o' to show/hide the profiler overlay, 't' to start/stop recording
+//  a profile (built with PROFILE=1 ./build_and_run.sh, see profiler.h).
+//  Command line: --skinning=scalar|sse4.1|avx2   --threads=<n>   --verify-skinning
+//                --bake[=<frames per tick>]   --gpu-skinning   --verify-gpu-skinning
+//                --no-asset-cache   --crowd=<n>   --crowd-spacing=<footprints>
+//                --crowd-scatter   --crowd-sweep   --native-rate   --frame-cache[=<MB>]
+//                --no-culling   --profile[=<output prefix>]
+//                --compress-clips[=<position error>,<angle error in degrees>]
+//                --no-lod   --lod-pixels=<screen height of the full meshes>
+//                --stream-bvh[=<window frames>]
+//  Batch rendering (no window or display needed, see batch_render.h):
+//                --render=<clip>[:<first tick>-<last tick>] (repeatable; clips 0-2 are
+//                the characters, 3 is the dwarf on the BVH walk)   --render-out=<prefix>
+//                --render-size=<pixels>   --render-step=<ticks>   --render-turntable=<degrees>
+//                Frames are written to <prefix><job>_<clip>_<frame>.png, numbered from 0
+//                within each --render job (jobs counted from 0 in command line order).
 //  ========================================================================
 
 #include <iostream>
 #include <map>
+#include <future>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <IL/il.h>
 using namespace std;
@@ -17,42 +47,83 @@ using namespace std;
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "assimp_extras.h"
+#include "character.h"
+#include "crowd.h"
+#include "gl_mesh.h"
+#include "gpu_skinning.h"
+#include "floor.h"
+#include "texture_cache.h"
+#include "draw_list.h"
+#include "batch_render.h"
 
 //----------Globals----------------------------
-const aiScene* scenes[3] = {NULL};
-aiAnimation* animations[4] = {NULL};
-int curr_scene = 0;
 float angle = 0;
 float camera_z = 3;
 float speed = 0;
-int floor_z = 0;
-aiVector3D scene_min[3], scene_max[3], scene_center[3];
+float floor_z = 0;
 float rotate_speed = 0;
 std::map<int, int> texIdMap[3];
-std::map<int, int> dwarf_mapping = {
-	{6, 15},
-	{2, 18},
-	{3, 19},
-	{7, 16},
-	{4, 20},
-	{8, 17},
-	{13, 4},
-	{10, 2}
-};
+std::vector<GLMesh> glMeshes[3]; //Vertex/index buffers of every mesh
+DrawList drawLists[3]; //Flattened node tree and sorted draws of each scene
+bool streamsDirty[3] = {false}; //Skinned vertices not yet uploaded
+bool gpuSkinning = false; //Skin in the vertex shader (--gpu-skinning, toggled with 'g')
+bool gpuSkinningAvailable = false;
+GPUSkinScene gpuScenes[3]; //Bind pose, skin tables and palette buffer of each scene
+bool paletteDirty[3] = {false}; //Bone palettes not yet uploaded
+Floor floorMesh; //Checkerboard, built once in initialise()
+const int frameInterval = 16; //Update period (m.sec.), about the display rate
+std::chrono::steady_clock::time_point lastUpdate; //Time of the previous update()
+bool paused = false; //Animation clock stopped ('p')
+PoseKey posedKeys[3]; //What the skinned vertices or palettes of each scene were computed for
+bool posed[3] = {false};
+bool frustumCulling = true; //Skip meshes and crowd instances outside the view ('v', --no-culling)
+std::vector<Box> meshBoxes[3]; //Animated bounds of every mesh of the current pose (root space)
+Box characterBoxes[3];         //and of the whole character
+const float fovy = 35, zNear = 0.1, zFar = 1000.0; //Perspective projection
+bool showProfile = false; //Profiler overlay ('o')
+std::string profilePrefix = "profile"; //Recorded profiles go to <prefix>.json and <prefix>.csv ('t', --profile)
 
-bool dwarf_2 = false;
+struct RenderJob
+{
+	int clip;           //0-2: the characters, 3: the dwarf on the BVH walk
+	double first, last; //Tick range (inclusive), last < 0 for the whole clip
+};
+bool batchMode = false; //Render clips offscreen to PNG files instead of opening a window (--render=...)
+std::vector<RenderJob> renderJobs;
+std::string renderPrefix = "frame_"; //Frames go to <prefix><job>_<clip>_<frame>.png
+int renderSize = 600; //Width and height of the batch frames
+double renderStep = 1; //Ticks between batch frames
+float renderTurntable = 0; //Camera rotation per batch frame (degrees)
+BatchRenderer batchRenderer;
 
-int tDuration[4]; //Animation duration in ticks.
-int currTick[4] = {0}; //current tick
-float timeStep = 50; //Animation time step = 50 m.sec.
+struct CrowdStats
+{
+	int frames;
+	double poseMs, drawMs;
+	CrowdStats() : frames(0), poseMs(0), drawMs(0) {}
+};
+bool crowdMode = false; //Draw a crowd of the current character ('c' or --crowd=<n>)
+int crowdSize = 100;
+float crowdSpacing = 1.5; //Grid spacing, in character footprints
+bool crowdScatter = false; //Jitter positions and headings
+Crowd crowds[3];
+GPUCrowd gpuCrowd;
+bool crowdDirty = false; //Crowd palettes not yet uploaded
+PoseKey crowdPoseKeys[3]; //What the crowd palettes of each scene were computed for
+bool crowdPosed[3] = {false};
+CrowdStats crowdStats;
 
-struct meshInit
+struct DecodedTexture
 {
-	int mNumVertices;
-	aiVector3D* mVertices;
-	aiVector3D* mNormals;
+	int material;
+	std::string name;
+	std::shared_ptr<TextureData> data; //NULL if the image couldn't be loaded
 };
-meshInit* initData[3];
+std::future<bool> sceneLoads[3]; //Import and texture decoding of each scene
+std::vector<DecodedTexture> decodedTextures[3];
+bool sceneReady[3] = {false}; //Uploaded and ready to draw
+std::map<unsigned long long, GLuint> textureIds; //Uploaded textures by image hash, shared by all scenes
+std::chrono::steady_clock::time_point loadStart;
 
 //------------Modify the following as needed----------------------
 float materialCol[4] = { 0.9, 0.9, 0.9, 1 }; //Default material colour (not used if model's colour is available)
@@ -61,55 +132,23 @@ float lightPosn[4] = { 0, 50, 50, 1 }; //Default light's position
 bool twoSidedLight = true; //Change to 'true' to enable two-sided lighting
 float m_col[4] = { 0.2, 0.2, 0.2, 1 };
 
-//-------Loads model data from file and creates a scene object----------
-bool loadModel(const char* fileName, const char* anim_file, int index)
+// Size of the window, or of the batch frames
+int viewportWidth()
 {
-    const aiScene* scene = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality);
-    if (scene == NULL)
-        exit(1);
-    if (scene->HasAnimations()) {
-		animations[index] = scene->mAnimations[0];
-		tDuration[index] = scene->mAnimations[0]->mDuration;
-	}
-	if (anim_file != NULL)
-	{
-		const aiScene* q = aiImportFile(anim_file, aiProcessPreset_TargetRealtime_MaxQuality);
-		animations[index+((index+1)%2)] = q->mAnimations[0];
-		tDuration[index+((index+1)%2)] = animations[index+((index+1)%2)]->mDuration;
-	}
-	
-	aiMesh* mesh;
-	int numVert;
-	initData[index] = new meshInit[scene->mNumMeshes];
-	for (int m = 0; m < scene->mNumMeshes; m++)
-	{
-		mesh = scene->mMeshes[m];
-		numVert = mesh->mNumVertices;
-		(initData[index] + m)->mNumVertices = numVert;
-		(initData[index] + m)->mVertices = new aiVector3D[numVert];
-		(initData[index] + m)->mNormals = new aiVector3D[numVert];
-		
-		for (int n = 0; n < numVert; n++) {
-			(initData[index] + m)->mVertices[n] = mesh->mVertices[n];
-			(initData[index] + m)->mNormals[n] = mesh->mNormals[n];
-		}
-	}
-	
-    //~ printSceneInfo(scene);
-    //~ printMeshInfo(scene);
-    //~ if (index == 2)  printTreeInfo(scene->mRootNode);
-    //~ if (index == 2) printBoneInfo(scene);
-    //~ if (index == 2) printAnimInfo(scene);  //WARNING:  This may generate a lengthy output if the model has animation data
-    get_bounding_box(scene, &scene_min[index], &scene_max[index]);
-    scenes[index] = scene;
-    return true;
+    return batchMode ? renderSize : glutGet(GLUT_WINDOW_WIDTH);
+}
+
+int viewportHeight()
+{
+    return batchMode ? renderSize : glutGet(GLUT_WINDOW_HEIGHT);
 }
 
 //-------------Loads texture files using DevIL library-------------------------------
-void loadGLTextures(const aiScene* scene, int index)
+// Images are decoded (or mapped from the texture cache) on the loader threads;
+// only the upload is left for the GL thread (see texture_cache.h).
+void decodeTextures(const aiScene* scene, std::vector<DecodedTexture>* textures)
 {
-    /* initialization of DevIL */
-    ilInit();
+    PROFILE_SCOPE("decodeTextures");
     if (scene->HasTextures()) {
         std::cout << "Support for meshes with embedded textures is not implemented" << endl;
         return;
@@ -126,282 +165,111 @@ void loadGLTextures(const aiScene* scene, int index)
 			{
 				c--;
 			}
-            glEnable(GL_TEXTURE_2D);
-            ILuint imageId;
-            GLuint texId;
-            ilGenImages(1, &imageId);
-            glGenTextures(1, &texId);
-            texIdMap[index][m] = texId; //store tex ID against material id in a hash map
-            ilBindImage(imageId); /* Binding of DevIL image name */
-            ilEnable(IL_ORIGIN_SET);
-            ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
-            if (ilLoadImage((ILstring)c)) //if success
-            {
-                /* Convert image to RGBA */
-                ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
-
-                /* Create and load textures to OpenGL */
-                glBindTexture(GL_TEXTURE_2D, texId);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH),
-                    ilGetInteger(IL_IMAGE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                    ilGetData());
-                glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-                cout << "Texture:" << c << " successfully loaded." << endl;
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-                glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-                glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-            }
-            else {
-                cout << "Couldn't load Image: " << c << endl;
-            }
+            DecodedTexture tex;
+            tex.material = m;
+            tex.name = c;
+            tex.data = loadTextureData(c, GLEW_EXT_texture_compression_s3tc);
+            textures->push_back(tex);
         }
     } //loop for material
 }
 
-// ------A recursive function to traverse scene graph and render each mesh----------
-void render(const aiScene* sc, const aiNode* nd)
+// Creates the GL textures of a scene. Images already uploaded for another
+// material or scene are shared.
+void uploadTextures(const std::vector<DecodedTexture>& textures, int index)
 {
-    aiMatrix4x4 m = nd->mTransformation;
-    aiMesh* mesh;
-    aiFace* face;
-    aiMaterial* mtl;
-    GLuint texId;
-    aiColor4D diffuse;
-    int meshIndex, materialIndex;
-
-    aiTransposeMatrix4(&m); //Convert to column-major order
-    glPushMatrix();
-    glMultMatrixf((float*)&m); //Multiply by the transformation matrix for this node
-
-    // Draw all meshes assigned to this node
-    for (int n = 0; n < nd->mNumMeshes; n++) {
-        meshIndex = nd->mMeshes[n]; //Get the mesh indices from the current node
-        mesh = sc->mMeshes[meshIndex]; //Using mesh index, get the mesh object
-
-        materialIndex = mesh->mMaterialIndex; //Get material index attached to the mesh
-        mtl = sc->mMaterials[materialIndex];
-        if (replaceCol)
-            glColor4fv(materialCol); //User-defined colour
-        else if (AI_SUCCESS == aiGetMaterialColor(mtl, AI_MATKEY_COLOR_DIFFUSE, &diffuse)) //Get material colour from model
-            glColor4f(diffuse.r, diffuse.g, diffuse.b, 1.0);
-        else
-            glColor4fv(materialCol); //Default material colour
-
-        if (mesh->HasTextureCoords(0)) {
-            texId = texIdMap[curr_scene][mesh->mMaterialIndex];
-            glBindTexture(GL_TEXTURE_2D, texId);
+    PROFILE_SCOPE("uploadTextures");
+    bool compress = GLEW_EXT_texture_compression_s3tc;
+    for (unsigned int t = 0; t < textures.size(); t++) {
+        const DecodedTexture& tex = textures[t];
+        glEnable(GL_TEXTURE_2D);
+        if (!tex.data)
+        {
+            GLuint texId;
+            glGenTextures(1, &texId);
+            texIdMap[index][tex.material] = texId;
+            cout << "Couldn't load Image: " << tex.name << endl;
+            continue;
         }
-        else
+        std::map<unsigned long long, GLuint>::iterator it = textureIds.find(tex.data->hash);
+        if (it != textureIds.end())
         {
-			glDisable(GL_TEXTURE_2D);
-			glColor4fv(m_col);
-		}
-
-        //Get the polygons from each mesh and draw them
-        for (int k = 0; k < mesh->mNumFaces; k++) {
-            face = &mesh->mFaces[k];
-            GLenum face_mode;
-
-            switch (face->mNumIndices) {
-            case 1:
-                face_mode = GL_POINTS;
-                break;
-            case 2:
-                face_mode = GL_LINES;
-                break;
-            case 3:
-                face_mode = GL_TRIANGLES;
-                break;
-            default:
-                face_mode = GL_POLYGON;
-                break;
-            }
-
-            glBegin(face_mode);
-
-            for (int i = 0; i < face->mNumIndices; i++) {
-                int vertexIndex = face->mIndices[i];
-                if (mesh->HasVertexColors(0))
-                    glColor4fv((GLfloat*)&mesh->mColors[0][vertexIndex]);
-
-                if (mesh->HasTextureCoords(0)) {
-                    glTexCoord2f(mesh->mTextureCoords[0][vertexIndex].x,
-                        mesh->mTextureCoords[0][vertexIndex].y);
-                }
-
-                if (mesh->HasNormals())
-                    glNormal3fv(&mesh->mNormals[vertexIndex].x);
-
-                glVertex3fv(&mesh->mVertices[vertexIndex].x);
-            }
-
-            glEnd();
+            texIdMap[index][tex.material] = it->second;
+            continue;
         }
+        GLuint texId = uploadTexture(tex.data.get(), compress);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        textureIds[tex.data->hash] = texId;
+        texIdMap[index][tex.material] = texId; //store tex ID against material id in a hash map
+        cout << "Texture:" << tex.name << " successfully loaded (" << tex.data->levels.size() << " levels, "
+            << (tex.data->format == GL_RGBA ? "RGBA" : "DXT5") << ", " << textureDataBytes(tex.data.get()) / 1024 << " KB)" << endl;
     }
-
-    // Draw all children
-    for (int i = 0; i < nd->mNumChildren; i++)
-        render(sc, nd->mChildren[i]);
-
-    glPopMatrix();
-    glEnable(GL_TEXTURE_2D);
 }
 
-// Update node vertices in character animation sequence
-
-void updateNodeMatrices(int tick, const aiScene* scene)
+// Colour and texture of a mesh of a scene from its material
+void resolveMaterial(int index, int meshIndex, DrawMaterial* out)
 {
-	
-    int index;
-    int n_animation = curr_scene;
-    aiAnimation* anim = animations[n_animation];
-    if (dwarf_2 && curr_scene == 2)
+    const aiScene* sc = scenes[index];
+    const aiMesh* mesh = sc->mMeshes[meshIndex];
+    aiColor4D diffuse;
+    aiMaterial* mtl = sc->mMaterials[mesh->mMaterialIndex]; //Get material attached to the mesh
+    if (replaceCol)
+        memcpy(out->colour, materialCol, sizeof(out->colour)); //User-defined colour
+    else if (AI_SUCCESS == aiGetMaterialColor(mtl, AI_MATKEY_COLOR_DIFFUSE, &diffuse)) //Get material colour from model
     {
-		n_animation = 3;
-	}
-    aiMatrix4x4 matPos, matRot, matProd;
-    aiMatrix3x3 matRot3;
-    aiNode* nd;
-    int prev_index;
-    for (int i = 0; i < anim->mNumChannels; i++) {
-		if (n_animation == 3) anim = animations[2];
-		else anim = animations[n_animation];
-		int anim_n = i;
-
-        matPos = aiMatrix4x4();
-        //Identity
-        matRot = aiMatrix4x4();
-        aiNodeAnim* ndAnim = anim->mChannels[anim_n]; //Channel
-        
-        if (ndAnim->mNumPositionKeys > 1)
-        {
-            index = 0;
-            prev_index = ndAnim->mNumPositionKeys - 1;
-            while (tick > ndAnim->mPositionKeys[index].mTime)
-			{
-				index++;
-				prev_index = index - 1;
-			}
-		}
-        else
-            index = 0;
-        if (i == 1 && n_animation == 3) index = 0;
-        aiVector3D posn = (ndAnim->mPositionKeys[index]).mValue;
-        matPos.Translation(posn, matPos);
-        aiQuaternion rotn;
-        
-        if (n_animation == 3 && dwarf_mapping[i])
-		{
-			anim_n = dwarf_mapping[i];
-			anim = animations[3];
-			tick = currTick[3];
-		}
-		else if (n_animation == 3) tick = currTick[n_animation-1];
-		ndAnim = anim->mChannels[anim_n];
-		if(curr_scene == 1 && i == 23) continue;
-        
-        if (ndAnim->mNumRotationKeys > 1)
-        {
-			if (curr_scene == 0) rotn = (ndAnim->mRotationKeys[index]).mValue;
-			else {
-				index = 0;
-				prev_index = ndAnim->mNumRotationKeys - 1;
-				
-				while (tick > ndAnim->mRotationKeys[index].mTime)
-				{
-					index++;
-					prev_index = index - 1;
-				}
-				aiQuaternion rotn1 = (ndAnim->mRotationKeys[prev_index]).mValue;
-				aiQuaternion rotn2 = (ndAnim->mRotationKeys[index]).mValue;
-				float time1 = (ndAnim->mRotationKeys[prev_index]).mTime;
-				float time2 = (ndAnim->mRotationKeys[index]).mTime;
-				float factor = (tick-time1)/(time2-time1);
-				rotn.Interpolate(rotn, rotn1, rotn2, factor);
-			}
-		}
-			
-        else
-        {
-            index = 0;
-			rotn = (ndAnim->mRotationKeys[index]).mValue;
-		}
-        matRot3 = rotn.GetMatrix();
-        matRot = aiMatrix4x4(matRot3);
+        float colour[4] = { diffuse.r, diffuse.g, diffuse.b, 1.0 };
+        memcpy(out->colour, colour, sizeof(out->colour));
+    }
+    else
+        memcpy(out->colour, materialCol, sizeof(out->colour)); //Default material colour
 
-        matProd = matPos * matRot;
-        
-        if (n_animation == 3)
-		{
-			anim = animations[2];
-		}
-        
-        ndAnim = anim->mChannels[i];
-		nd = scene->mRootNode->FindNode(ndAnim->mNodeName);
-        if (nd != NULL) nd->mTransformation = matProd;
+    out->textured = compactMeshes[index][meshIndex].hasTexCoords();
+    out->texture = 0;
+    out->vertexColours = mesh->HasVertexColors(0);
+    if (out->textured) {
+        std::map<int, int>::const_iterator it = texIdMap[index].find(mesh->mMaterialIndex);
+        if (it != texIdMap[index].end()) out->texture = it->second;
     }
+    else
+        memcpy(out->colour, m_col, sizeof(out->colour));
 }
 
-// Transform vertices of character models
-void transformVertices(const aiScene* scene)
-{
-	aiMesh* mesh;
-	aiBone* bone;
-	aiMatrix4x4 offset;
-	aiMatrix4x4 m;
-	aiMatrix4x4 normal;
-	aiNode* nd;
-	aiNode* parent;
-	aiVector3D vert;
-	aiVector3D norm;
-	
-	int vid;
-	float weight;
-	
-	for (int n = 0; n < scene->mNumMeshes; n++) {
-        mesh = scene->mMeshes[n]; //Get the mesh object
-		aiMatrix4x4* transforms = (aiMatrix4x4*) calloc(mesh->mNumVertices, sizeof(aiMatrix4x4));
-		aiMatrix4x4* normals = (aiMatrix4x4*) calloc(mesh->mNumVertices, sizeof(aiMatrix4x4));
-		for (int b = 0; b < mesh->mNumBones; b++)
-		{
-			bone = mesh->mBones[b];
-			offset = bone->mOffsetMatrix;
-			nd = scene->mRootNode->FindNode(bone->mName);
-			parent = nd->mParent;
-			m = nd->mTransformation * offset;
-			
-			while (parent != NULL)
-			{
-				m = parent->mTransformation * m;
-				parent = parent->mParent;
-			}
-			
-			normal = m;
-			normal.Inverse().Transpose();
-			
-			for (int w = 0; w < bone->mNumWeights; w++) {
-				vid = (bone->mWeights[w]).mVertexId;
-				weight = (bone->mWeights[w]).mWeight;
-				
-				transforms[vid] = transforms[vid] + m * weight;
-				normals[vid] = normal * weight;
-			}
-			
-			
-		}
-		for (int i = 0; i < mesh->mNumVertices; i++)
-		{
-			vert = (initData[curr_scene] + n)->mVertices[i];
-			mesh->mVertices[i] = transforms[i] * vert;
-			norm = (initData[curr_scene] + n)->mNormals[i];
-			mesh->mNormals[i] = normals[i] * vert;
-		}
-		free(transforms);
-		free(normals);
+// Resolves the materials of a scene and flattens its node tree (after its
+// textures are uploaded)
+void compileDrawList(int index)
+{
+    DrawList* list = &drawLists[index];
+    list->materials.resize(scenes[index]->mNumMeshes);
+    for (unsigned int m = 0; m < scenes[index]->mNumMeshes; m++)
+		resolveMaterial(index, m, &list->materials[m]);
+    buildDrawList(scenes[index], list);
+}
+
+// ------Draws the meshes of the current scene from its draw list----------
+// view is the scene's modelview matrix; the node transforms of the current
+// pose are composed with it in one pass before drawing
+void render(const aiMatrix4x4& view)
+{
+    DrawList* list = &drawLists[curr_scene];
+    updateDrawMatrices(list, view);
+    DrawState state;
+    int loadedNode = -1;
+    for (unsigned int k = 0; k < list->items.size(); k++)
+    {
+		int meshIndex = list->items[k].mesh;
+		if (!meshVisible[curr_scene].empty() && !meshVisible[curr_scene][meshIndex]) continue; //Culled
+
+		const DrawMaterial* mtl = &list->materials[meshIndex];
+		applyDrawMaterial(mtl, &state);
+		applyDrawNode(list, list->items[k].node, &loadedNode);
+		const MeshLevel* level = sceneMeshLevel(curr_scene, meshIndex, lodLevel[curr_scene]);
+		if (gpuSkinning)
+			drawGPUSkinMesh(&gpuScenes[curr_scene], meshIndex, &glMeshes[curr_scene][meshIndex], mtl->textured,
+				level->firstIndex, level->numIndices);
+		else
+			drawGLMesh(&glMeshes[curr_scene][meshIndex], level->firstIndex, level->numIndices);
 	}
+    glEnable(GL_TEXTURE_2D);
 }
 
 //--------------------OpenGL initialization------------------------
@@ -425,39 +293,303 @@ void initialise()
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, white);
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 50);
     glColor4fv(materialCol);
-    loadModel("ArmyPilot.x", NULL, 0); //<<<-------------Specify input file name here
-    loadModel("mannequin.fbx", "run.fbx", 1);
-    loadModel("dwarf.x", "avatar_walk.bvh", 2);
-    loadGLTextures(scenes[0], 0);
-    loadGLTextures(scenes[1], 1);
-    loadGLTextures(scenes[2], 2);
+    createFloor(-90, &floorMesh);
+    gpuSkinningAvailable = initGPUSkinning();
+    if (!gpuSkinningAvailable)
+    {
+		cout << "GPU skinning is not supported by this context" << endl;
+		gpuSkinning = false;
+		crowdMode = false;
+	}
+    else
+		createGPUCrowd(&gpuCrowd);
+
+    /* initialization of DevIL */
+    ilInit();
+    loadStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < 3; i++)
+    {
+		sceneLoads[i] = std::async(std::launch::async, [i] {
+			if (!loadModel(modelFiles[i], companionFiles[i], i)) return false;
+			decodeTextures(scenes[i], &decodedTextures[i]);
+			return true;
+		});
+	}
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluPerspective(35, 1, 0.1, 1000.0);
+    gluPerspective(fovy, 1, zNear, zFar);
+}
+
+// GL side of loading a scene, once its loader thread has finished
+void uploadScene(int i)
+{
+    if (!sceneLoads[i].get())
+    {
+		cout << "Couldn't load " << modelFiles[i] << endl;
+		exit(1);
+	}
+    uploadTextures(decodedTextures[i], i);
+    decodedTextures[i].clear();
+    compileDrawList(i);
+    glMeshes[i].resize(scenes[i]->mNumMeshes);
+    for (unsigned int m = 0; m < scenes[i]->mNumMeshes; m++)
+		createGLMesh(scenes[i]->mMeshes[m], &compactMeshes[i][m], &glMeshes[i][m]);
+    if (gpuSkinningAvailable)
+    {
+		createGPUSkinScene(scenes[i], compactMeshes[i], skinTables[i], glMeshes[i], &gpuScenes[i]);
+		computeGlobalTransforms(&skeletons[i]);
+		updateBonePalettes(scenes[i], &skeletons[i]);
+		paletteDirty[i] = true;
+	}
+    sceneReady[i] = true;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+    cout << "Scene " << i << " (" << modelFiles[i] << ") ready after " << ms << " ms" << endl;
+}
+
+// Uploads the scenes that have finished loading since the last call
+void pollSceneLoads()
+{
+    for (int i = 0; i < 3; i++)
+		if (!sceneReady[i] && sceneLoads[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			uploadScene(i);
+}
+
+void waitForScenes()
+{
+    for (int i = 0; i < 3; i++)
+		if (!sceneReady[i]) uploadScene(i);
+}
+
+// Placement of a scene on the floor: the model-specific orientation and
+// scale, with the centre of the model's bounding box at the origin
+aiMatrix4x4 sceneToWorld(int scene)
+{
+    aiMatrix4x4 m, t;
+    if (scene == 1)
+    {
+		aiMatrix4x4::Translation(aiVector3D(0, -120, 0), t);
+		m = m * t;
+		aiMatrix4x4::Scaling(aiVector3D(0.01, 0.01, 0.01), t);
+		m = m * t;
+	}
+    else if (scene == 0)
+    {
+		aiMatrix4x4::RotationX(AI_MATH_PI_F / 2, t);
+		m = m * t;
+		aiMatrix4x4::RotationZ(AI_MATH_PI_F / 2, t);
+		m = m * t;
+	}
+    // center the model
+    aiMatrix4x4::Translation(-(scene_min[scene] + scene_max[scene]) * 0.5, t);
+    return m * t;
+}
+
+// Scale that fits the bind pose of a scene into the view
+float fitScale(int scene)
+{
+    float tmp = scene_max[scene].x - scene_min[scene].x;
+    tmp = aisgl_max(scene_max[scene].y - scene_min[scene].y, tmp);
+    tmp = aisgl_max(scene_max[scene].z - scene_min[scene].z, tmp);
+    return 1.f / tmp;
+}
+
+aiVector3D cameraEye()
+{
+    return aiVector3D(camera_z * sin(angle), 0, camera_z * cos(angle));
+}
+
+// View * fit scale * placement of the scene: its root space to eye space, as
+// set up by drawScene()
+aiMatrix4x4 sceneToView(int scene)
+{
+    float scale = fitScale(scene);
+    aiMatrix4x4 s;
+    aiMatrix4x4::Scaling(aiVector3D(scale, scale, scale), s);
+    return lookAtMatrix(cameraEye(), aiVector3D(0, 0, 0), aiVector3D(0, 1, 0)) * s * sceneToWorld(scene);
+}
+
+// Projection * view * fit scale of the scene, as set up by drawScene()
+aiMatrix4x4 worldToClip(int scene)
+{
+    float scale = fitScale(scene);
+    aiMatrix4x4 s;
+    aiMatrix4x4::Scaling(aiVector3D(scale, scale, scale), s);
+    return perspectiveMatrix(fovy, 1, zNear, zFar) * lookAtMatrix(cameraEye(), aiVector3D(0, 0, 0), aiVector3D(0, 1, 0)) * s;
+}
+
+// Visibility of the meshes of the current scene for its animated bounds
+void cullScene()
+{
+    std::vector<char>& visible = meshVisible[curr_scene];
+    if (!frustumCulling)
+    {
+		visible.clear();
+		return;
+	}
+    aiMatrix4x4 toClip = worldToClip(curr_scene) * sceneToWorld(curr_scene);
+    bool characterVisible = !boxOutsideFrustum(toClip, characterBoxes[curr_scene]);
+    visible.resize(scenes[curr_scene]->mNumMeshes);
+    for (unsigned int m = 0; m < visible.size(); m++)
+		visible[m] = characterVisible && !boxOutsideFrustum(toClip, meshBoxes[curr_scene][m]);
+}
+
+// Level of detail of the current scene for the screen size of its animated
+// bounds
+void selectSceneLevel()
+{
+    int level = 0;
+    if (useLOD)
+    {
+		aiMatrix4x4 toClip = worldToClip(curr_scene) * sceneToWorld(curr_scene);
+		float pixels = projectedSize(toClip, characterBoxes[curr_scene], viewportHeight());
+		level = selectLevel(lodLevel[curr_scene], pixels, lodPixels, numSceneLevels(curr_scene));
+	}
+    lodLevel[curr_scene] = level;
+}
+
+// Lays the crowd of the current scene out for crowdSize instances, spaced by
+// crowdSpacing times the footprint of the character on the floor
+void layoutCurrentCrowd()
+{
+    Crowd* crowd = &crowds[curr_scene];
+    if (crowd->items.empty()) buildCrowd(curr_scene, crowd);
+    int maxSize = maxCrowdPaletteEntries() / crowd->stride;
+    if (crowdSize > maxSize)
+    {
+		cout << "Crowd limited to " << maxSize << " instances by the palette buffer size" << endl;
+		crowdSize = maxSize;
+	}
+    crowdPosed[curr_scene] = false;
+    Box bind;
+    growBox(&bind, scene_min[curr_scene]);
+    growBox(&bind, scene_max[curr_scene]);
+    Box onFloor = transformBox(sceneToWorld(curr_scene), bind);
+    float footprint = aisgl_max(onFloor.max.x - onFloor.min.x, onFloor.max.z - onFloor.min.z);
+    layoutCrowd(crowd, crowdSize, footprint * crowdSpacing, crowdScatter);
+    crowdStats = CrowdStats();
+    cout << "Crowd of " << crowdSize << " x " << modelFiles[curr_scene] << endl;
+}
+
+// Poses of all instances of the current scene's crowd
+void updateCrowd()
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    evaluateCrowd(&crowds[curr_scene], currTick[curr_scene], sceneToWorld(curr_scene));
+    crowdStats.poseMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    crowdDirty = true;
+}
+
+void drawCrowd()
+{
+    PROFILE_SCOPE("drawCrowd");
+    const Crowd* crowd = &crowds[curr_scene];
+    const aiScene* sc = scenes[curr_scene];
+    const DrawList* list = &drawLists[curr_scene];
+    DrawState state;
+    int numVisible = crowd->visible.size();
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if (crowdDirty && numVisible > 0)
+    {
+		uploadCrowdPalettes(&gpuCrowd, crowd->palettes.data(), numVisible * crowd->stride);
+		crowdDirty = false;
+	}
+    beginGPUCrowd(&gpuCrowd, crowd->stride, twoSidedLight);
+    for (unsigned int k = 0; k < crowd->items.size() && numVisible > 0; k++)
+    {
+		int meshIndex = crowd->items[k].mesh;
+		const aiMesh* mesh = sc->mMeshes[meshIndex];
+		const DrawMaterial* mtl = &list->materials[meshIndex];
+		applyDrawMaterial(mtl, &state);
+		for (int l = 0; l < MAX_LOD_LEVELS; l++)
+		{
+			int first = crowd->levelStart[l], count = crowd->levelStart[l + 1] - first;
+			if (count == 0) continue;
+			const MeshLevel* level = sceneMeshLevel(curr_scene, meshIndex, l);
+			drawGPUSkinCrowdItem(&gpuScenes[curr_scene], meshIndex, &glMeshes[curr_scene][meshIndex], mtl->textured,
+				crowd->items[k].offset, mesh->mNumBones, first, count, level->firstIndex, level->numIndices);
+		}
+	}
+    glEnable(GL_TEXTURE_2D);
+    endGPUSkinning();
+    glFinish(); //Include the GPU time in the report
+    crowdStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    if (++crowdStats.frames == 40)
+    {
+		cout << "Crowd of " << crowd->instances.size() << " (" << numVisible << " visible): pose " << crowdStats.poseMs / 40
+			<< " ms, upload+draw " << crowdStats.drawMs / 40 << " ms per frame" << endl;
+		crowdStats = CrowdStats();
+	}
+}
+
+// The floor scrolls under characters whose clip walks: not under the dwarf's
+// own (in place) clip, nor under a dwarf crowd, which plays that clip too
+bool floorScrolls()
+{
+    return curr_scene != 2 || (dwarf_2 && !crowdMode);
+}
+
+// Poses and skins the current scene (or its crowd) unless that was already
+// done for the current animation time and clip. Meshes and crowd instances
+// outside the view are culled before skinning, and the level of detail is
+// selected; a coarser level reuses the vertices already skinned.
+void poseCurrentScene()
+{
+    PROFILE_SCOPE("poseCurrentScene");
+    PoseKey key = currentPoseKey();
+    if (crowdMode)
+    {
+		key.sourceTick = -1; //Crowds don't play the retargeted walk (see crowd.h)
+		if ((int)crowds[curr_scene].instances.size() != crowdSize) layoutCurrentCrowd();
+		bool culled = cullCrowd(&crowds[curr_scene], frustumCulling, worldToClip(curr_scene), sceneToWorld(curr_scene),
+			viewportHeight());
+		if (!culled && crowdPosed[curr_scene] && key == crowdPoseKeys[curr_scene]) return;
+		updateCrowd();
+		crowdPoseKeys[curr_scene] = key;
+		crowdPosed[curr_scene] = true;
+		return;
+	}
+    bool changed = !posed[curr_scene] || !(key == posedKeys[curr_scene]);
+    if (changed)
+    {
+		updateNodeMatrices(key.tick, scenes[curr_scene]);
+		evaluateBonePalettes(scenes[curr_scene]);
+		animatedBounds(scenes[curr_scene], &skeletons[curr_scene], &skinBounds[curr_scene],
+			&meshBoxes[curr_scene], &characterBoxes[curr_scene]);
+	}
+    cullScene();
+    selectSceneLevel();
+    //Meshes coming into view, or a finer level, need skinning
+    if (!changed && !visibleMeshStale(curr_scene) && (gpuSkinning || !levelStale(curr_scene))) return;
+    if (gpuSkinning)
+		paletteDirty[curr_scene] = true;
+    else
+    {
+		skinPoseCached(scenes[curr_scene], key.tick, key.sourceTick);
+		streamsDirty[curr_scene] = true;
+	}
+    posedKeys[curr_scene] = key;
+    posed[curr_scene] = true;
 }
 
 //----Timer callback for continuous rotation of the model about y-axis----
+// Moves the camera, the floor and the animation clock on by the time elapsed
+// since the previous call; the pose itself is evaluated when it is displayed.
 void update(int value)
 {
-	if (dwarf_2 || !(curr_scene == 2)) floor_z = (floor_z - 3) % 100;
-    angle += rotate_speed;
-    camera_z += speed;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = aisgl_min(std::chrono::duration<double>(now - lastUpdate).count(), 0.25);
+    double steps = seconds * 1000 / timeStep; //Camera and floor speeds are per time step
+    lastUpdate = now;
+	if (!paused && floorScrolls()) floor_z = fmod(floor_z - 3 * steps, 100);
+    angle += rotate_speed * steps;
+    camera_z += speed * steps;
     if (angle > 360)
         angle = 0;
-    int n_animation = curr_scene;
-    if (dwarf_2 && curr_scene == 2)
-    {
-		n_animation = 2;
-	}
-    if (currTick[n_animation] < tDuration[n_animation]) {
-        updateNodeMatrices(currTick[n_animation], scenes[curr_scene]);
-        transformVertices(scenes[curr_scene]);
-    }
-    currTick[n_animation] = (currTick[n_animation] + 1) % tDuration[n_animation];
-    if (dwarf_2 && curr_scene == 2) currTick[n_animation+1] = (currTick[n_animation+1] + 1) % tDuration[n_animation+1];
+    pollSceneLoads();
+    if (sceneReady[curr_scene] && !paused) advanceClock(seconds);
 
     glutPostRedisplay();
-    glutTimerFunc(50, update, 0);
+    glutTimerFunc(frameInterval, update, 0);
 }
 
 //----Keyboard callback to toggle initial model orientation---
@@ -473,6 +605,55 @@ void keyboard(unsigned char key, int x, int y)
 	{
 		dwarf_2 = true;
 	}
+	else if (key == 'b' && bakedClips[0].numFrames > 0)
+	{
+		useBakedPoses = !useBakedPoses;
+		cout << "Baked poses " << (useBakedPoses ? "on" : "off") << endl;
+	}
+	else if (key == 'g' && gpuSkinningAvailable && sceneReady[curr_scene])
+	{
+		gpuSkinning = !gpuSkinning;
+		posed[curr_scene] = false; //Skin into the other representation
+		cout << (gpuSkinning ? "GPU" : "CPU") << " skinning" << endl;
+	}
+	else if (key == 'c' && gpuSkinningAvailable && sceneReady[curr_scene])
+	{
+		crowdMode = !crowdMode;
+		cout << "Crowd " << (crowdMode ? "on" : "off") << endl;
+	}
+	else if ((key == '+' || key == '=') && crowdMode)
+		crowdSize *= 2;
+	else if (key == '-' && crowdMode && crowdSize > 1)
+		crowdSize /= 2;
+	else if (key == 'f' && useFrameCache)
+		printFrameCacheStats(modelFiles);
+	else if (key == 'l')
+	{
+		useLOD = !useLOD;
+		cout << "Level of detail selection " << (useLOD ? "on" : "off") << endl;
+	}
+	else if (key == 'v')
+	{
+		frustumCulling = !frustumCulling;
+		cout << "Frustum culling " << (frustumCulling ? "on" : "off") << endl;
+	}
+	else if (key == 'p')
+	{
+		paused = !paused;
+		cout << "Animation " << (paused ? "paused" : "resumed") << endl;
+	}
+#ifdef ENABLE_PROFILER
+	else if (key == 'o')
+		showProfile = !showProfile;
+	else if (key == 't')
+		toggleProfileRecording(profilePrefix.c_str());
+#endif
+	else if (key == 'k')
+	{
+		do skinKernel = (SkinningKernel)((skinKernel + 1) % NUM_SKIN_KERNELS);
+		while (!skinningKernelSupported(skinKernel));
+		cout << "Skinning kernel: " << skinningKernelNames[skinKernel] << endl;
+	}
     glutPostRedisplay();
 }
 
@@ -508,87 +689,368 @@ void specialUp(int key, int x, int y)
 	}
 }
 
-void drawFloor()
+// The floor is scrolled by floor_z; scale is the scene's fit-to-view scale
+void drawFloor(float scale)
 {
+	PROFILE_SCOPE("drawFloor");
 	glDisable(GL_TEXTURE_2D);
-    bool flag = false;
-    glBegin(GL_QUADS);
-    glNormal3f(0, -1, 0);
-    for(int x = -5000; x <= 5000; x += 50)
-    {
-        for(int z = -5000; z <= 5000; z += 50)
-        {
-            if(flag) glColor4f(0.93, 0.73, 0.67, 1.0);
-            else glColor4f(0.22, 0.89, 0.94, 1.0);
-            glVertex3f(x, -90, z + floor_z);
-            glVertex3f(x, -90, z+50 + floor_z);
-            glVertex3f(x+50, -90, z+50 + floor_z);
-            glVertex3f(x+50, -90, z + floor_z);
-            flag = !flag;
-        }
-    }
-    glEnd();
+    glPushMatrix();
+    glTranslatef(0, 0, floor_z);
+    //Camera position and view direction in floor coordinates
+    aiVector3D eye = cameraEye();
+    aiVector3D viewDir = -eye;
+    viewDir.Normalize();
+    eye /= scale;
+    eye.z -= floor_z;
+    float pixelsPerUnit = viewportHeight() / (2 * tan(fovy * M_PI / 360));
+    drawFloorBlocks(&floorMesh, eye, viewDir, pixelsPerUnit, zFar / scale);
+    glPopMatrix();
     glEnable(GL_TEXTURE_2D);
 }
 
 //------The main display function---------
 //----The model is first drawn using a display list so that all GL commands are
 //    stored for subsequent display updates.
-void display()
+void drawScene()
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!sceneReady[curr_scene]) return; //Still loading
 
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    gluLookAt(camera_z * sin(angle), 0, camera_z * cos(angle), 0, 0, 0, 0, 1, 0);
+    aiVector3D eye = cameraEye();
+    gluLookAt(eye.x, eye.y, eye.z, 0, 0, 0, 0, 1, 0);
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosn);
 
     
 
     // scale the whole asset to fit into our view frustum
-    float tmp = scene_max[curr_scene].x - scene_min[curr_scene].x;
-    tmp = aisgl_max(scene_max[curr_scene].y - scene_min[curr_scene].y, tmp);
-    tmp = aisgl_max(scene_max[curr_scene].z - scene_min[curr_scene].z, tmp);
-    tmp = 1.f / tmp;
+    float tmp = fitScale(curr_scene);
     glScalef(tmp, tmp, tmp);
-    drawFloor();
-    if (curr_scene == 1){
-		glTranslatef(0, -120, 0);
-		glScalef(0.01, 0.01, 0.01);
+    drawFloor(tmp);
+    if (crowdMode)
+    {
+		drawCrowd();
+		return;
+	}
+    aiMatrix4x4 toView = sceneToView(curr_scene);
+    if (gpuSkinning)
+    {
+		PROFILE_SCOPE("render");
+		if (paletteDirty[curr_scene])
+		{
+			uploadBonePalettes(scenes[curr_scene], &skeletons[curr_scene], &gpuScenes[curr_scene]);
+			paletteDirty[curr_scene] = false;
+		}
+		beginGPUSkinning(&gpuScenes[curr_scene], twoSidedLight);
+		render(toView);
+		endGPUSkinning();
 	}
-    else if (curr_scene == 0)
+    else
     {
-		glRotatef(90, 1, 0, 0);
-		glRotatef(90, 0, 0, 1); 
+		PROFILE_SCOPE("render");
+		if (streamsDirty[curr_scene])
+		{
+			for (unsigned int m = 0; m < scenes[curr_scene]->mNumMeshes; m++)
+				updateGLMeshStreams(scenes[curr_scene]->mMeshes[m], &glMeshes[curr_scene][m],
+					sceneMeshLevel(curr_scene, m, skinnedLevel[curr_scene])->numVertices);
+			streamsDirty[curr_scene] = false;
+		}
+		render(toView);
 	}
-    float xc = (scene_min[curr_scene].x + scene_max[curr_scene].x) * 0.5;
-    float yc = (scene_min[curr_scene].y + scene_max[curr_scene].y) * 0.5;
-    float zc = (scene_min[curr_scene].z + scene_max[curr_scene].z) * 0.5;
-    // center the model
-    glTranslatef(-xc, -yc, -zc);
-    render(scenes[curr_scene], scenes[curr_scene]->mRootNode);
+}
 
+#ifdef ENABLE_PROFILER
+// Averages of the last frames' timers and counters in the top left corner
+void drawProfileOverlay()
+{
+    std::vector<std::string> lines = profileSummary();
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, viewportWidth(), viewportHeight(), 0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glColor3f(1, 1, 0);
+    for (unsigned int i = 0; i < lines.size(); i++)
+    {
+		glRasterPos2i(8, 18 + 15 * i);
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)lines[i].c_str());
+	}
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
+
+// Writes the profile being recorded when the program ends
+void finishProfile()
+{
+    if (profiler.recording) toggleProfileRecording(profilePrefix.c_str());
+}
+#endif
+
+void display()
+{
+    if (sceneReady[curr_scene]) poseCurrentScene();
+    drawScene();
+#ifdef ENABLE_PROFILER
+    if (showProfile) drawProfileOverlay();
+#endif
+    {
+		PROFILE_SCOPE("glutSwapBuffers");
+		glutSwapBuffers();
+	}
+    PROFILE_FRAME();
+}
+
+// Skins every mesh of every scene mid-animation on the GPU, captures the
+// positions with transform feedback and compares them with the scalar CPU
+// kernel. Fails if any vertex differs by more than a small fraction of the
+// model's size (the GPU may fuse and order the blend differently).
+bool verifyGPUSkinning()
+{
+	if (!gpuSkinningAvailable) return false;
+	bool passed = true;
+	std::vector<aiVector3D> cpuVerts, cpuNorms, gpuVerts;
+	for (curr_scene = 0; curr_scene < 3; curr_scene++)
+	{
+		const aiScene* scene = scenes[curr_scene];
+		Skeleton* skel = &skeletons[curr_scene];
+		aiVector3D extent = scene_max[curr_scene] - scene_min[curr_scene];
+		float size = aisgl_max(extent.x, aisgl_max(extent.y, extent.z));
+		updateNodeMatrices(tDuration[curr_scene] / 2, scene);
+		evaluateBonePalettes(scene);
+		uploadBonePalettes(scene, skel, &gpuScenes[curr_scene]);
+		beginGPUSkinning(&gpuScenes[curr_scene], false);
+		float maxErr = 0;
+		for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+		{
+			const CompactMesh* bind = &compactMeshes[curr_scene][m];
+			int numVert = bind->numVertices;
+			cpuVerts.resize(numVert);
+			cpuNorms.resize(numVert);
+			skinVertices(SKIN_SCALAR, &skinTables[curr_scene][m], skel->palette[m].data(), bind,
+				cpuVerts.data(), cpuNorms.data(), 0, numVert);
+			captureGPUSkinnedPositions(&gpuScenes[curr_scene], m, numVert, &gpuVerts);
+			for (int i = 0; i < numVert; i++)
+				maxErr = aisgl_max(maxErr, (gpuVerts[i] - cpuVerts[i]).Length() / size);
+		}
+		endGPUSkinning();
+		bool ok = maxErr < 1e-4;
+		cout << "Scene " << curr_scene << ": GPU vs CPU skinning, max relative error = " << maxErr
+			<< (ok ? "  PASS" : "  FAIL") << endl;
+		passed = passed && ok;
+	}
+	curr_scene = 0;
+	return passed;
+}
+
+
+
+// Frame times of crowds of 1, 2, 4, ... instances of each character, up to
+// the size the palette buffer can hold (or 4096)
+bool crowdSweep()
+{
+	if (!gpuSkinningAvailable) return false;
+	const int frames = 20;
+	crowdMode = true;
+	cout << "scene  instances   visible   pose ms   draw ms  frame ms  us/instance" << endl;
+	for (curr_scene = 0; curr_scene < 3; curr_scene++)
+	{
+		if (crowds[curr_scene].items.empty()) buildCrowd(curr_scene, &crowds[curr_scene]);
+		int maxSize = aisgl_min(maxCrowdPaletteEntries() / crowds[curr_scene].stride, 4096);
+		for (crowdSize = 1; crowdSize <= maxSize; crowdSize *= 2)
+		{
+			layoutCurrentCrowd();
+			cullCrowd(&crowds[curr_scene], frustumCulling, worldToClip(curr_scene), sceneToWorld(curr_scene),
+				viewportHeight());
+			double poseMs = 0, drawMs = 0;
+			for (int f = 0; f < frames; f++)
+			{
+				std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+				evaluateCrowd(&crowds[curr_scene], f, sceneToWorld(curr_scene));
+				crowdDirty = true;
+				std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+				drawScene();
+				std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+				PROFILE_FRAME();
+				poseMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+				drawMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+			}
+			poseMs /= frames;
+			drawMs /= frames;
+			printf("%5d %10d %9d %9.3f %9.3f %9.3f %12.2f\n", curr_scene, crowdSize, (int)crowds[curr_scene].visible.size(), poseMs, drawMs,
+				poseMs + drawMs, (poseMs + drawMs) * 1000 / crowdSize);
+		}
+	}
+	curr_scene = 0;
+	return true;
+}
 
-    glutSwapBuffers();
+// Parses <clip>[:<first tick>-<last tick>]
+bool parseRenderJob(const char* spec, RenderJob* job)
+{
+	char* end;
+	job->clip = strtol(spec, &end, 10);
+	job->first = 0;
+	job->last = -1;
+	if (end == spec || job->clip < 0 || job->clip > 3) return false;
+	if (*end == 0) return true;
+	if (sscanf(end, ":%lf-%lf", &job->first, &job->last) != 2) return false;
+	return job->first >= 0 && job->last >= job->first;
+}
+
+// Renders the frames of every --render clip offscreen and writes them as PNG
+// files. Each frame is posed and drawn at its tick (the floor scrolls and the
+// camera turns as they would have by then in the viewer) and its readback
+// overlaps the drawing of the following frames.
+bool renderBatch()
+{
+	if (!createBatchTargets(&batchRenderer, renderSize, renderSize, numThreads)) return false;
+	float startAngle = angle;
+	long totalFrames = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int j = 0; j < renderJobs.size(); j++)
+	{
+		const RenderJob& job = renderJobs[j];
+		curr_scene = job.clip == 3 ? 2 : job.clip;
+		dwarf_2 = job.clip == 3;
+		double duration = dwarf_2 ? tDuration[3] * ticksPerSecond(2) / ticksPerSecond(3) : tDuration[curr_scene];
+		double last = job.last >= 0 ? job.last : duration - renderStep;
+		int numFrames = (int)floor((last - job.first) / renderStep + 1e-6) + 1;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		for (int f = 0; f < numFrames; f++)
+		{
+			double t = job.first + f * renderStep;
+			currTick[curr_scene] = fmod(t, aisgl_max(tDuration[curr_scene], 1));
+			if (dwarf_2) currTick[3] = fmod(t * ticksPerSecond(3) / ticksPerSecond(2), aisgl_max(tDuration[3], 1));
+			double steps = t / ticksPerSecond(curr_scene) * 1000 / timeStep;
+			floor_z = floorScrolls() ? fmod(-3 * steps, 100) : 0;
+			angle = startAngle + renderTurntable * M_PI / 180 * (totalFrames + f);
+			poseCurrentScene();
+			drawScene();
+			char name[48];
+			snprintf(name, sizeof(name), "%u_%d_%05d.png", j, job.clip, f); //Unique even for jobs on the same clip
+			readBatchFrame(&batchRenderer, renderPrefix + name);
+			PROFILE_FRAME();
+		}
+		finishBatchFrames(&batchRenderer);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		printf("Clip %d, ticks %g-%g: %d frames in %.2f s, %.1f frames/s\n", job.clip, job.first, last, numFrames, seconds,
+			numFrames / seconds);
+		totalFrames += numFrames;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%ld frames (%dx%d) in %.2f s, %.1f frames/s; waited %.1f ms for readbacks and %.1f ms for encoders\n",
+		totalFrames, renderSize, renderSize, seconds, totalFrames / seconds, batchRenderer.readbackWaitMs,
+		batchRenderer.encodeWaitMs);
+	if (batchRenderer.failures > 0) cout << batchRenderer.failures << " frames could not be written" << endl;
+	return batchRenderer.failures == 0;
 }
 
 int main(int argc, char** argv)
 {
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
-    glutInitWindowSize(600, 600);
-    glutCreateWindow("Model Loader");
-    glutInitContextVersion(4, 2);
-    glutInitContextProfile(GLUT_CORE_PROFILE);
+    //Batch rendering draws into a headless context instead of a GLUT window
+    for (int i = 1; i < argc; i++)
+		if (strncmp(argv[i], "--render=", 9) == 0) batchMode = true;
+    if (batchMode)
+    {
+		if (!createHeadlessContext(&batchRenderer)) return 1;
+	}
+    else
+    {
+		glutInit(&argc, argv);
+		glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
+		glutInitWindowSize(600, 600);
+		glutCreateWindow("Model Loader");
+	}
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    //GLEW built for GLX has loaded the entry points before it looks for an X display
+    if (batchMode && err == GLEW_ERROR_NO_GLX_DISPLAY) err = GLEW_OK;
+#endif
+    if (err != GLEW_OK)
+    {
+		cout << "GLEW initialisation failed: " << glewGetErrorString(err) << endl;
+		return 1;
+	}
+    if (!batchMode)
+    {
+		glutInitContextVersion(4, 2);
+		glutInitContextProfile(GLUT_CORE_PROFILE);
+	}
+
+    bool verify = false, verifyGPU = false, sweep = false;
+    skinKernel = bestSkinningKernel();
+    for (int i = 1; i < argc; i++)
+    {
+		if (parseCharacterOption(argv[i])) continue;
+		if (strcmp(argv[i], "--verify-skinning") == 0) verify = true;
+		else if (strcmp(argv[i], "--verify-gpu-skinning") == 0) verifyGPU = true;
+		else if (strcmp(argv[i], "--gpu-skinning") == 0) gpuSkinning = true;
+		else if (strncmp(argv[i], "--crowd=", 8) == 0)
+		{
+			crowdMode = true;
+			crowdSize = aisgl_max(atoi(argv[i] + 8), 1);
+		}
+		else if (strncmp(argv[i], "--crowd-spacing=", 16) == 0) crowdSpacing = atof(argv[i] + 16);
+		else if (strcmp(argv[i], "--crowd-scatter") == 0) crowdScatter = true;
+		else if (strcmp(argv[i], "--no-culling") == 0) frustumCulling = false;
+		else if (strcmp(argv[i], "--no-lod") == 0) useLOD = false;
+		else if (strncmp(argv[i], "--lod-pixels=", 13) == 0) lodPixels = atof(argv[i] + 13);
+		else if (strcmp(argv[i], "--crowd-sweep") == 0) sweep = true;
+		else if (strncmp(argv[i], "--render=", 9) == 0)
+		{
+			RenderJob job;
+			if (!parseRenderJob(argv[i] + 9, &job))
+			{
+				cout << "Expected --render=<clip 0-3>[:<first tick>-<last tick>]: " << argv[i] << endl;
+				return 1;
+			}
+			renderJobs.push_back(job);
+		}
+		else if (strncmp(argv[i], "--render-out=", 13) == 0) renderPrefix = argv[i] + 13;
+		else if (strncmp(argv[i], "--render-size=", 14) == 0) renderSize = aisgl_max(atoi(argv[i] + 14), 1);
+		else if (strncmp(argv[i], "--render-step=", 14) == 0) renderStep = atof(argv[i] + 14);
+		else if (strncmp(argv[i], "--render-turntable=", 19) == 0) renderTurntable = atof(argv[i] + 19);
+#ifdef ENABLE_PROFILER
+		else if (strncmp(argv[i], "--profile", 9) == 0)
+		{
+			if (argv[i][9] == '=') profilePrefix = argv[i] + 10;
+			if (!profiler.recording) toggleProfileRecording(profilePrefix.c_str());
+		}
+#endif
+	}
+#ifdef ENABLE_PROFILER
+    atexit(finishProfile);
+#endif
+    atexit(releaseBVHStreams);
+    if (renderStep <= 0) renderStep = 1;
+    startWorkers();
 
     initialise();
+    if (useBakedPoses || useCompressedClips || verify || verifyGPU || sweep || batchMode) waitForScenes();
+    if (useBakedPoses) bakeAnimations();
+    if (useCompressedClips) compressAnimations();
+    if (batchMode) return renderBatch() ? 0 : 1;
+    if (verify) return verifySkinning() ? 0 : 1;
+    if (verifyGPU) return verifyGPUSkinning() ? 0 : 1;
+    if (sweep) return crowdSweep() ? 0 : 1;
     glutDisplayFunc(display);
-    glutTimerFunc(50, update, 0);
+    lastUpdate = std::chrono::steady_clock::now();
+    glutTimerFunc(frameInterval, update, 0);
     glutSetKeyRepeat(GLUT_KEY_REPEAT_OFF);
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(specialDown);
     glutSpecialUpFunc(specialUp);
     glutMainLoop();
 
-    aiReleaseImport(scenes[0]);
+    releaseCached(scenes[0]);
 }
@@ -0,0 +1,156 @@
+//  ========================================================================
+//  COSC422: Advanced Computer Graphics;  University of Canterbury (2019)
+//
+//  FILE NAME: Benchmark.cpp
+//
+//  Headless animation/skinning benchmark. Loads the viewer's characters with
+//  loadModel() (no window or GL context needed), drives N ticks of
+//  updateNodeMatrices() and transformVertices() for every scene, including
+//  the dwarf_2 retargeted walk, and writes per-stage timings as JSON.
+//
+//  Command line: --ticks=<n>   --out=<file>   --lod-level=<level of detail>
+//                plus the viewer's
+//                --skinning=scalar|sse4.1|avx2   --threads=<n>   --bake[=<rate>]
+//                --no-asset-cache   --frame-cache[=<MB>]
+//                --compress-clips[=<position error>,<angle error in degrees>]
+//                --stream-bvh[=<window frames>]
+//  ========================================================================
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+using namespace std;
+
+#include <assimp/cimport.h>
+#include <assimp/types.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include "assimp_extras.h"
+#include "character.h"
+
+struct BenchCase
+{
+	const char* name;
+	int scene;
+	bool dwarf_2;
+};
+
+const BenchCase benchCases[] = {
+	{ "ArmyPilot.x", 0, false },
+	{ "mannequin.fbx+run.fbx", 1, false },
+	{ "dwarf.x", 2, false },
+	{ "dwarf.x+avatar_walk.bvh", 2, true }
+};
+const int numStages = 3;
+const char* stageNames[numStages] = { "updateNodeMatrices", "transformVertices", "frame" };
+const int warmupTicks = 20;
+
+// ----------------------------------------------------------------------------
+double percentile(const vector<double>& sorted, double p)
+{
+	int i = (int)(p * (sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+// ----------------------------------------------------------------------------
+void writeStage(ostream& out, const char* name, vector<double> ns, long vertices, bool last)
+{
+	sort(ns.begin(), ns.end());
+	double mean = 0;
+	for (unsigned int i = 0; i < ns.size(); i++) mean += ns[i];
+	mean /= ns.size();
+	out << "        \"" << name << "\": { \"mean_ns\": " << mean
+		<< ", \"p50_ns\": " << percentile(ns, 0.5)
+		<< ", \"p90_ns\": " << percentile(ns, 0.9)
+		<< ", \"p99_ns\": " << percentile(ns, 0.99)
+		<< ", \"max_ns\": " << ns.back()
+		<< ", \"vertices_per_s\": " << (vertices > 0 ? vertices * 1e9 / mean : 0)
+		<< " }" << (last ? "" : ",") << endl;
+}
+
+int main(int argc, char** argv)
+{
+	int numTicks = 1000;
+	int level = 0;
+	const char* outFile = NULL;
+	skinKernel = bestSkinningKernel();
+	for (int i = 1; i < argc; i++)
+	{
+		if (parseCharacterOption(argv[i])) continue;
+		if (strncmp(argv[i], "--ticks=", 8) == 0) numTicks = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "--out=", 6) == 0) outFile = argv[i] + 6;
+		else if (strncmp(argv[i], "--lod-level=", 12) == 0) level = aisgl_max(atoi(argv[i] + 12), 0);
+		else
+		{
+			cerr << "Unknown option " << argv[i] << endl;
+			return 1;
+		}
+	}
+	if (numTicks < 1) numTicks = 1;
+
+	//Keep stdout for the JSON report: loader messages go to stderr
+	streambuf* stdoutBuf = cout.rdbuf(cerr.rdbuf());
+	startWorkers();
+	loadCharacters();
+	if (useBakedPoses) bakeAnimations();
+	if (useCompressedClips) compressAnimations();
+	cout.rdbuf(stdoutBuf);
+
+	ofstream file;
+	if (outFile != NULL) file.open(outFile);
+	ostream& out = (outFile != NULL) ? file : cout;
+
+	out << "{" << endl;
+	out << "  \"ticks\": " << numTicks << ", \"threads\": " << numThreads
+		<< ", \"kernel\": \"" << skinningKernelNames[skinKernel] << "\", \"baked\": "
+		<< (useBakedPoses ? "true" : "false") << ", \"frame_cache_mb\": "
+		<< (useFrameCache ? frameCacheBudget / 1048576.0 : 0) << ", \"lod_level\": " << level << "," << endl;
+	out << "  \"scenes\": [" << endl;
+	int numCases = sizeof(benchCases) / sizeof(benchCases[0]);
+	for (int c = 0; c < numCases; c++)
+	{
+		curr_scene = benchCases[c].scene;
+		dwarf_2 = benchCases[c].dwarf_2;
+		currTick[curr_scene] = currTick[3] = 0;
+		lodLevel[curr_scene] = level;
+		const aiScene* scene = scenes[curr_scene];
+		long vertices = 0;
+		for (unsigned int m = 0; m < scene->mNumMeshes; m++) vertices += sceneMeshLevel(curr_scene, m, level)->numVertices;
+
+		vector<double> ns[numStages];
+		long hits = frameCaches[curr_scene].hits, misses = frameCaches[curr_scene].misses;
+		for (int t = -warmupTicks; t < numTicks; t++)
+		{
+			chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			updateNodeMatrices(currTick[curr_scene], scene);
+			chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+			evaluateBonePalettes(scene);
+			skinPoseCached(scene, currTick[curr_scene], dwarf_2 ? currTick[3] : -1);
+			chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+			advanceTicks();
+			if (t < 0) continue;
+			ns[0].push_back(chrono::duration<double, nano>(t1 - t0).count());
+			ns[1].push_back(chrono::duration<double, nano>(t2 - t1).count());
+			ns[2].push_back(chrono::duration<double, nano>(t2 - t0).count());
+		}
+
+		out << "    { \"name\": \"" << benchCases[c].name << "\", \"meshes\": " << scene->mNumMeshes
+			<< ", \"vertices\": " << vertices << "," << endl;
+		if (useFrameCache)
+			out << "      \"frame_cache\": { \"hits\": " << frameCaches[curr_scene].hits - hits
+				<< ", \"misses\": " << frameCaches[curr_scene].misses - misses << " }," << endl;
+		out << "      \"stages\": {" << endl;
+		for (int s = 0; s < numStages; s++)
+			writeStage(out, stageNames[s], ns[s], s == 0 ? 0 : vertices, s == numStages - 1);
+		out << "      }" << endl;
+		out << "    }" << (c == numCases - 1 ? "" : ",") << endl;
+	}
+	out << "  ]" << endl;
+	out << "}" << endl;
+	releaseBVHStreams();
+	return 0;
+}
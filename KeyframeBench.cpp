@@ -0,0 +1,79 @@
+//  ========================================================================
+//  COSC422: Advanced Computer Graphics;  University of Canterbury (2019)
+//
+//  FILE NAME: KeyframeBench.cpp
+//
+//  Microbenchmark for keyframe lookup: cost per lookup of the cursor-based
+//  findKey() (keyframes.h) against the linear scan from key 0, for synthetic
+//  clips of increasing length played forward over two loops.
+//  Build: g++ -O2 -o KeyframeBench KeyframeBench.cpp
+//  ========================================================================
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+using namespace std;
+
+#include <assimp/cimport.h>
+#include <assimp/types.h>
+#include <assimp/scene.h>
+#include "assimp_extras.h"
+#include "keyframes.h"
+
+const int numChannels = 32;
+const double tickStep = 0.5; //Fractional ticks, as when sampling by elapsed time
+
+double elapsedNs(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+	unsigned int lengths[] = { 100, 1000, 10000, 100000 };
+	unsigned long checksum = 0;
+
+	cout << "    keys   cursor ns/lookup   scan ns/lookup" << endl;
+	for (unsigned int len : lengths)
+	{
+		vector<aiVectorKey> keys(len);
+		for (unsigned int k = 0; k < len; k++)
+		{
+			keys[k].mTime = k;
+			keys[k].mValue = aiVector3D(k, 0, 0);
+		}
+		double duration = len - 1;
+
+		//Cursor lookup: every channel, every frame, two loops of the clip
+		vector<unsigned int> cursors(numChannels, 0);
+		long lookups = 0;
+		auto start = chrono::steady_clock::now();
+		for (int loop = 0; loop < 2; loop++)
+			for (double t = 0; t <= duration; t += tickStep)
+				for (int c = 0; c < numChannels; c++, lookups++)
+					checksum += findKey(keys.data(), len, t, &cursors[c]);
+		double cursorNs = elapsedNs(start) / lookups;
+
+		//Linear scan from key 0 on a sample of frames (a full playback is quadratic)
+		int samples = 1000;
+		lookups = 0;
+		start = chrono::steady_clock::now();
+		for (int s = 0; s < samples; s++)
+		{
+			double t = duration * s / samples;
+			for (int c = 0; c < numChannels; c++, lookups++)
+			{
+				unsigned int index = 0;
+				while (index < len - 1 && t > keys[index].mTime) index++;
+				checksum += index;
+			}
+		}
+		double scanNs = elapsedNs(start) / lookups;
+
+		cout.width(8); cout << len;
+		cout.width(19); cout << cursorNs;
+		cout.width(17); cout << scanNs << endl;
+	}
+	cout << "(checksum " << checksum << ")" << endl;
+	return 0;
+}
@@ -0,0 +1,617 @@
+// ----------------------------------------------------------------------------
+// Binary cache of post-processed assets
+//
+// importCached() is a drop-in replacement for aiImportFile(). The first import
+// of a file writes the post-processed scene to <file>.aicache: node tree,
+// meshes, bones with their weights, the diffuse colour and (resolved) texture
+// file of every material, and the animation clips. The cache is keyed by a
+// hash of the source file contents and the import flags. Later runs map the
+// cache file and build the aiScene around it: the small objects (nodes,
+// meshes, bones, channels) are allocated, but every large array (vertex
+// streams, face indices, weights, keys) points straight into the mapping.
+// The mapping is private, so the viewer can still skin into mVertices.
+// Tangents, metadata and material properties other than the above are not
+// stored; scenes with embedded textures, lights or cameras are not cached.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ASSET_CACHE_MAGIC "AICACHE1"
+#define ASSET_CACHE_VERSION 1
+
+struct AssetCacheHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int importFlags;
+	unsigned long long sourceHash;    //FNV-1a of the source file
+	unsigned long long sourceSize;
+	unsigned long long payloadSize;   //Bytes following the header
+	unsigned short layout[6];         //Sizes of the structures stored as raw arrays
+};
+
+struct CachedScene
+{
+	const aiScene* scene;
+	void* mapping;
+	size_t mappingSize;
+};
+
+std::vector<CachedScene> cachedScenes; //Scenes built by importCached() from a cache file
+std::mutex cachedScenesLock; //Scenes may be imported on several threads at once
+
+// ----------------------------------------------------------------------------
+void assetCacheLayout(unsigned short* layout)
+{
+	layout[0] = sizeof(aiVector3D);
+	layout[1] = sizeof(aiColor4D);
+	layout[2] = sizeof(aiVertexWeight);
+	layout[3] = sizeof(aiMatrix4x4);
+	layout[4] = sizeof(aiVectorKey);
+	layout[5] = sizeof(aiQuatKey);
+}
+
+// ----------------------------------------------------------------------------
+unsigned long long fnv1a(const unsigned char* data, size_t size, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Hash of the contents of a file. Returns false if the file can't be read.
+bool hashFile(const char* path, unsigned long long* hash, unsigned long long* size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	*size = st.st_size;
+	*hash = fnv1a(NULL, 0);
+	if (st.st_size > 0)
+	{
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+		*hash = fnv1a((const unsigned char*)data, st.st_size);
+		munmap(data, st.st_size);
+	}
+	close(fd);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Writer: plain values are packed, arrays are aligned to 16 bytes so that they
+// can be used in place once the file is mapped.
+struct CacheWriter
+{
+	std::vector<char> data;
+
+	template <class T> void put(const T& value)
+	{
+		const char* p = (const char*)&value;
+		data.insert(data.end(), p, p + sizeof(T));
+	}
+	void putArray(const void* array, size_t bytes)
+	{
+		data.resize((data.size() + 15) & ~(size_t)15);
+		if (bytes > 0) data.insert(data.end(), (const char*)array, (const char*)array + bytes);
+	}
+	void putString(const aiString& s)
+	{
+		put(s.length);
+		data.insert(data.end(), s.data, s.data + s.length);
+	}
+};
+
+// ----------------------------------------------------------------------------
+struct CacheReader
+{
+	char* base;
+	size_t size;
+	size_t pos;
+	bool ok;
+
+	template <class T> T get()
+	{
+		T value;
+		memset((void*)&value, 0, sizeof(T));
+		if (pos + sizeof(T) > size) ok = false;
+		else memcpy((void*)&value, base + pos, sizeof(T));
+		pos += sizeof(T);
+		return value;
+	}
+	//A count that can't possibly fit in the rest of the file marks it corrupt
+	unsigned int getCount()
+	{
+		unsigned int n = get<unsigned int>();
+		if (n > size - aisgl_min(pos, size)) ok = false;
+		return ok ? n : 0;
+	}
+	template <class T> T* getArray(size_t count)
+	{
+		pos = (pos + 15) & ~(size_t)15;
+		if (!ok || count == 0 || pos + count * sizeof(T) > size)
+		{
+			if (count > 0) ok = false;
+			return NULL;
+		}
+		T* array = (T*)(base + pos);
+		pos += count * sizeof(T);
+		return array;
+	}
+	void getString(aiString* s)
+	{
+		unsigned int length = get<unsigned int>();
+		if (length >= MAXLEN || pos + length > size) ok = false;
+		if (!ok) length = 0;
+		s->length = length;
+		memcpy(s->data, base + pos, length);
+		s->data[length] = '\0';
+		pos += length;
+	}
+};
+
+// ----------------------------------------------------------------------------
+// Texture files are looked up by file name alone (see loadGLTextures)
+aiString resolveTexturePath(const aiString& path)
+{
+	const char* c = strrchr(path.data, '/');
+	const char* b = strrchr(path.data, '\\');
+	if (b > c) c = b;
+	return aiString(c == NULL ? path.data : c + 1);
+}
+
+void writeNode(CacheWriter* w, const aiNode* node)
+{
+	w->putString(node->mName);
+	w->put(node->mTransformation);
+	w->put(node->mNumMeshes);
+	w->putArray(node->mMeshes, node->mNumMeshes * sizeof(unsigned int));
+	w->put(node->mNumChildren);
+	for (unsigned int i = 0; i < node->mNumChildren; i++) writeNode(w, node->mChildren[i]);
+}
+
+void writeMesh(CacheWriter* w, const aiMesh* mesh)
+{
+	int numVert = mesh->mNumVertices;
+	w->putString(mesh->mName);
+	w->put(mesh->mPrimitiveTypes);
+	w->put(mesh->mMaterialIndex);
+	w->put(mesh->mNumVertices);
+	w->putArray(mesh->mVertices, numVert * sizeof(aiVector3D));
+	w->put((unsigned char)mesh->HasNormals());
+	if (mesh->HasNormals()) w->putArray(mesh->mNormals, numVert * sizeof(aiVector3D));
+	for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++)
+	{
+		w->put((unsigned char)mesh->HasVertexColors(k));
+		if (mesh->HasVertexColors(k)) w->putArray(mesh->mColors[k], numVert * sizeof(aiColor4D));
+	}
+	for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++)
+	{
+		w->put((unsigned char)mesh->HasTextureCoords(k));
+		if (!mesh->HasTextureCoords(k)) continue;
+		w->put(mesh->mNumUVComponents[k]);
+		w->putArray(mesh->mTextureCoords[k], numVert * sizeof(aiVector3D));
+	}
+
+	//Faces: index count of every face, then all indices
+	std::vector<unsigned int> faceSizes(mesh->mNumFaces), indices;
+	for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+	{
+		faceSizes[f] = mesh->mFaces[f].mNumIndices;
+		indices.insert(indices.end(), mesh->mFaces[f].mIndices, mesh->mFaces[f].mIndices + faceSizes[f]);
+	}
+	w->put(mesh->mNumFaces);
+	w->putArray(faceSizes.data(), faceSizes.size() * sizeof(unsigned int));
+	w->put((unsigned int)indices.size());
+	w->putArray(indices.data(), indices.size() * sizeof(unsigned int));
+
+	w->put(mesh->mNumBones);
+	for (unsigned int b = 0; b < mesh->mNumBones; b++)
+	{
+		const aiBone* bone = mesh->mBones[b];
+		w->putString(bone->mName);
+		w->put(bone->mOffsetMatrix);
+		w->put(bone->mNumWeights);
+		w->putArray(bone->mWeights, bone->mNumWeights * sizeof(aiVertexWeight));
+	}
+}
+
+void writeAnimation(CacheWriter* w, const aiAnimation* anim)
+{
+	w->putString(anim->mName);
+	w->put(anim->mDuration);
+	w->put(anim->mTicksPerSecond);
+	w->put(anim->mNumChannels);
+	for (unsigned int c = 0; c < anim->mNumChannels; c++)
+	{
+		const aiNodeAnim* chnl = anim->mChannels[c];
+		w->putString(chnl->mNodeName);
+		w->put((int)chnl->mPreState);
+		w->put((int)chnl->mPostState);
+		w->put(chnl->mNumPositionKeys);
+		w->putArray(chnl->mPositionKeys, chnl->mNumPositionKeys * sizeof(aiVectorKey));
+		w->put(chnl->mNumRotationKeys);
+		w->putArray(chnl->mRotationKeys, chnl->mNumRotationKeys * sizeof(aiQuatKey));
+		w->put(chnl->mNumScalingKeys);
+		w->putArray(chnl->mScalingKeys, chnl->mNumScalingKeys * sizeof(aiVectorKey));
+	}
+}
+
+// ----------------------------------------------------------------------------
+bool saveAssetCache(const aiScene* scene, const char* path, unsigned int flags,
+	unsigned long long sourceHash, unsigned long long sourceSize)
+{
+	CacheWriter w;
+	w.put(scene->mFlags);
+	w.put(scene->mNumMaterials);
+	for (unsigned int m = 0; m < scene->mNumMaterials; m++)
+	{
+		aiColor4D diffuse;
+		aiString texPath;
+		unsigned char hasDiffuse = aiGetMaterialColor(scene->mMaterials[m], AI_MATKEY_COLOR_DIFFUSE, &diffuse) == AI_SUCCESS;
+		unsigned char hasTexture = scene->mMaterials[m]->GetTexture(aiTextureType_DIFFUSE, 0, &texPath) == AI_SUCCESS;
+		w.put(hasDiffuse);
+		w.put(diffuse);
+		w.put(hasTexture);
+		if (hasTexture) w.putString(resolveTexturePath(texPath));
+	}
+	w.put(scene->mNumMeshes);
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++) writeMesh(&w, scene->mMeshes[m]);
+	writeNode(&w, scene->mRootNode);
+	w.put(scene->mNumAnimations);
+	for (unsigned int a = 0; a < scene->mNumAnimations; a++) writeAnimation(&w, scene->mAnimations[a]);
+
+	AssetCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ASSET_CACHE_MAGIC, 8);
+	header.version = ASSET_CACHE_VERSION;
+	header.importFlags = flags;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.payloadSize = w.data.size();
+	assetCacheLayout(header.layout);
+
+	//Write to a temporary file and rename, so a reader never maps a partial cache
+	std::string tmpPath = std::string(path) + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	if (fp == NULL) return false;
+	char pad[16] = { 0 };
+	size_t padding = (16 - sizeof(header) % 16) % 16; //Payload starts 16-byte aligned
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(pad, 1, padding, fp) == padding
+		&& fwrite(w.data.data(), 1, w.data.size(), fp) == w.data.size();
+	ok = (fclose(fp) == 0) && ok;
+	if (ok) ok = rename(tmpPath.c_str(), path) == 0;
+	if (!ok) remove(tmpPath.c_str());
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+aiNode* readNode(CacheReader* r, aiNode* parent)
+{
+	aiNode* node = new aiNode();
+	node->mParent = parent;
+	r->getString(&node->mName);
+	node->mTransformation = r->get<aiMatrix4x4>();
+	unsigned int numMeshes = r->getCount();
+	const unsigned int* meshes = r->getArray<unsigned int>(numMeshes);
+	if (meshes != NULL)
+	{
+		node->mMeshes = new unsigned int[numMeshes];
+		memcpy(node->mMeshes, meshes, numMeshes * sizeof(unsigned int));
+		node->mNumMeshes = numMeshes;
+	}
+	unsigned int numChildren = r->getCount();
+	if (numChildren > 0)
+	{
+		node->mChildren = new aiNode*[numChildren]();
+		node->mNumChildren = numChildren;
+		for (unsigned int i = 0; i < numChildren && r->ok; i++) node->mChildren[i] = readNode(r, node);
+	}
+	return node;
+}
+
+aiMesh* readMesh(CacheReader* r)
+{
+	aiMesh* mesh = new aiMesh();
+	r->getString(&mesh->mName);
+	mesh->mPrimitiveTypes = r->get<unsigned int>();
+	mesh->mMaterialIndex = r->get<unsigned int>();
+	unsigned int numVert = r->getCount();
+	mesh->mVertices = r->getArray<aiVector3D>(numVert);
+	mesh->mNumVertices = numVert;
+	if (r->get<unsigned char>()) mesh->mNormals = r->getArray<aiVector3D>(numVert);
+	for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++)
+		if (r->get<unsigned char>()) mesh->mColors[k] = r->getArray<aiColor4D>(numVert);
+	for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++)
+	{
+		if (!r->get<unsigned char>()) continue;
+		mesh->mNumUVComponents[k] = r->get<unsigned int>();
+		mesh->mTextureCoords[k] = r->getArray<aiVector3D>(numVert);
+	}
+
+	unsigned int numFaces = r->getCount();
+	const unsigned int* faceSizes = r->getArray<unsigned int>(numFaces);
+	unsigned int numIndices = r->getCount();
+	unsigned int* indices = r->getArray<unsigned int>(numIndices);
+	if (r->ok && numFaces > 0)
+	{
+		mesh->mFaces = new aiFace[numFaces];
+		mesh->mNumFaces = numFaces;
+		unsigned int next = 0;
+		for (unsigned int f = 0; f < numFaces && r->ok; f++)
+		{
+			if (next + faceSizes[f] > numIndices)
+			{
+				r->ok = false;
+				break;
+			}
+			mesh->mFaces[f].mNumIndices = faceSizes[f];
+			mesh->mFaces[f].mIndices = indices + next;
+			next += faceSizes[f];
+		}
+	}
+
+	unsigned int numBones = r->getCount();
+	if (r->ok && numBones > 0)
+	{
+		mesh->mBones = new aiBone*[numBones]();
+		mesh->mNumBones = numBones;
+		for (unsigned int b = 0; b < numBones && r->ok; b++)
+		{
+			aiBone* bone = new aiBone();
+			mesh->mBones[b] = bone;
+			r->getString(&bone->mName);
+			bone->mOffsetMatrix = r->get<aiMatrix4x4>();
+			unsigned int numWeights = r->getCount();
+			bone->mWeights = r->getArray<aiVertexWeight>(numWeights);
+			bone->mNumWeights = numWeights;
+		}
+	}
+	return mesh;
+}
+
+aiAnimation* readAnimation(CacheReader* r)
+{
+	aiAnimation* anim = new aiAnimation();
+	r->getString(&anim->mName);
+	anim->mDuration = r->get<double>();
+	anim->mTicksPerSecond = r->get<double>();
+	unsigned int numChannels = r->getCount();
+	if (numChannels == 0) return anim;
+	anim->mChannels = new aiNodeAnim*[numChannels]();
+	anim->mNumChannels = numChannels;
+	for (unsigned int c = 0; c < numChannels && r->ok; c++)
+	{
+		aiNodeAnim* chnl = new aiNodeAnim();
+		anim->mChannels[c] = chnl;
+		r->getString(&chnl->mNodeName);
+		chnl->mPreState = (aiAnimBehaviour)r->get<int>();
+		chnl->mPostState = (aiAnimBehaviour)r->get<int>();
+		chnl->mNumPositionKeys = r->getCount();
+		chnl->mPositionKeys = r->getArray<aiVectorKey>(chnl->mNumPositionKeys);
+		chnl->mNumRotationKeys = r->getCount();
+		chnl->mRotationKeys = r->getArray<aiQuatKey>(chnl->mNumRotationKeys);
+		chnl->mNumScalingKeys = r->getCount();
+		chnl->mScalingKeys = r->getArray<aiVectorKey>(chnl->mNumScalingKeys);
+	}
+	return anim;
+}
+
+// ----------------------------------------------------------------------------
+// Clears every pointer into the mapping so that the aiScene destructor only
+// frees what readScene() allocated.
+template <class T> void detachPointer(T*& p, const char* begin, const char* end)
+{
+	if ((const char*)p >= begin && (const char*)p < end) p = NULL;
+}
+
+void detachCachedScene(aiScene* scene, const char* begin, const char* end)
+{
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+		if (mesh == NULL) continue;
+		detachPointer(mesh->mVertices, begin, end);
+		detachPointer(mesh->mNormals, begin, end);
+		for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++) detachPointer(mesh->mColors[k], begin, end);
+		for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++) detachPointer(mesh->mTextureCoords[k], begin, end);
+		for (unsigned int f = 0; f < mesh->mNumFaces; f++) detachPointer(mesh->mFaces[f].mIndices, begin, end);
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
+			if (mesh->mBones[b] != NULL) detachPointer(mesh->mBones[b]->mWeights, begin, end);
+	}
+	for (unsigned int a = 0; a < scene->mNumAnimations; a++)
+	{
+		aiAnimation* anim = scene->mAnimations[a];
+		if (anim == NULL) continue;
+		for (unsigned int c = 0; c < anim->mNumChannels; c++)
+		{
+			aiNodeAnim* chnl = anim->mChannels[c];
+			if (chnl == NULL) continue;
+			detachPointer(chnl->mPositionKeys, begin, end);
+			detachPointer(chnl->mRotationKeys, begin, end);
+			detachPointer(chnl->mScalingKeys, begin, end);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Builds a scene around a mapped cache. Returns NULL if the cache is corrupt.
+aiScene* readScene(char* payload, size_t size)
+{
+	CacheReader r = { payload, size, 0, true };
+	aiScene* scene = new aiScene();
+	scene->mFlags = r.get<unsigned int>();
+
+	unsigned int numMaterials = r.getCount();
+	if (numMaterials > 0)
+	{
+		scene->mMaterials = new aiMaterial*[numMaterials]();
+		scene->mNumMaterials = numMaterials;
+	}
+	for (unsigned int m = 0; m < numMaterials && r.ok; m++)
+	{
+		aiMaterial* mtl = new aiMaterial();
+		scene->mMaterials[m] = mtl;
+		bool hasDiffuse = r.get<unsigned char>();
+		aiColor4D diffuse = r.get<aiColor4D>();
+		if (hasDiffuse) mtl->AddProperty(&diffuse, 1, AI_MATKEY_COLOR_DIFFUSE);
+		if (r.get<unsigned char>())
+		{
+			aiString texPath;
+			r.getString(&texPath);
+			mtl->AddProperty(&texPath, AI_MATKEY_TEXTURE_DIFFUSE(0));
+		}
+	}
+
+	unsigned int numMeshes = r.getCount();
+	if (r.ok && numMeshes > 0)
+	{
+		scene->mMeshes = new aiMesh*[numMeshes]();
+		scene->mNumMeshes = numMeshes;
+		for (unsigned int m = 0; m < numMeshes && r.ok; m++) scene->mMeshes[m] = readMesh(&r);
+	}
+	if (r.ok) scene->mRootNode = readNode(&r, NULL);
+
+	unsigned int numAnimations = r.getCount();
+	if (r.ok && numAnimations > 0)
+	{
+		scene->mAnimations = new aiAnimation*[numAnimations]();
+		scene->mNumAnimations = numAnimations;
+		for (unsigned int a = 0; a < numAnimations && r.ok; a++) scene->mAnimations[a] = readAnimation(&r);
+	}
+
+	if (!r.ok || r.pos != size)
+	{
+		detachCachedScene(scene, payload, payload + size);
+		delete scene;
+		return NULL;
+	}
+	return scene;
+}
+
+// ----------------------------------------------------------------------------
+// Maps a cache written by saveAssetCache(). Fails if the file is missing, was
+// written for a different source file, import flags, version or build.
+const aiScene* mapAssetCache(const char* path, unsigned int flags, unsigned long long sourceHash, unsigned long long sourceSize)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(AssetCacheHeader))
+		mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return NULL;
+
+	const AssetCacheHeader* header = (const AssetCacheHeader*)mapping;
+	size_t payloadStart = (sizeof(AssetCacheHeader) + 15) & ~(size_t)15;
+	unsigned short layout[6];
+	assetCacheLayout(layout);
+	aiScene* scene = NULL;
+	if (memcmp(header->magic, ASSET_CACHE_MAGIC, 8) == 0 && header->version == ASSET_CACHE_VERSION
+		&& header->importFlags == flags && header->sourceHash == sourceHash && header->sourceSize == sourceSize
+		&& memcmp(header->layout, layout, sizeof(layout)) == 0
+		&& (size_t)st.st_size == payloadStart + header->payloadSize)
+		scene = readScene((char*)mapping + payloadStart, header->payloadSize);
+	if (scene == NULL)
+	{
+		munmap(mapping, st.st_size);
+		return NULL;
+	}
+	CachedScene cached = { scene, mapping, (size_t)st.st_size };
+	std::lock_guard<std::mutex> lock(cachedScenesLock);
+	cachedScenes.push_back(cached);
+	return scene;
+}
+
+// ----------------------------------------------------------------------------
+// aiImportFile() through the cache. Falls back to a plain import (and rewrites
+// the cache) whenever the cache can't be used.
+const aiScene* importCached(const char* fileName, unsigned int flags)
+{
+	unsigned long long hash, size;
+	if (!hashFile(fileName, &hash, &size)) return aiImportFile(fileName, flags);
+	std::string cachePath = std::string(fileName) + ".aicache";
+	const aiScene* scene = mapAssetCache(cachePath.c_str(), flags, hash, size);
+	if (scene != NULL) return scene;
+
+	scene = aiImportFile(fileName, flags);
+	if (scene == NULL) return NULL;
+	if (scene->mNumTextures > 0 || scene->mNumLights > 0 || scene->mNumCameras > 0) return scene;
+	if (!saveAssetCache(scene, cachePath.c_str(), flags, hash, size))
+		cout << "Couldn't write asset cache: " << cachePath << endl;
+	return scene;
+}
+
+// ----------------------------------------------------------------------------
+// True if p points into the mapping of a cached scene
+bool inCacheMapping(const void* p)
+{
+	std::lock_guard<std::mutex> lock(cachedScenesLock);
+	for (unsigned int i = 0; i < cachedScenes.size(); i++)
+	{
+		const char* begin = (const char*)cachedScenes[i].mapping;
+		if ((const char*)p >= begin && (const char*)p < begin + cachedScenes[i].mappingSize) return true;
+	}
+	return false;
+}
+
+// Gives back the pages lying entirely inside an array of a cache mapping. The
+// mapping is private, so untouched pages are simply dropped (and would be
+// read from the file again if the array were used).
+void dropCachedPages(const void* array, size_t bytes)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = ((size_t)array + page - 1) & ~(page - 1);
+	size_t end = ((size_t)array + bytes) & ~(page - 1);
+	if (end > begin) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+// Frees an array of count elements of a scene returned by importCached() and
+// clears the pointer
+template <class T> void releaseSceneArray(T*& array, size_t count)
+{
+	if (array == NULL) return;
+	if (inCacheMapping(array)) dropCachedPages(array, count * sizeof(T));
+	else delete[] array;
+	array = NULL;
+}
+
+// ----------------------------------------------------------------------------
+// aiReleaseImport() for scenes returned by importCached()
+void releaseCached(const aiScene* scene)
+{
+	std::lock_guard<std::mutex> lock(cachedScenesLock);
+	for (unsigned int i = 0; i < cachedScenes.size(); i++)
+	{
+		if (cachedScenes[i].scene != scene) continue;
+		const char* begin = (const char*)cachedScenes[i].mapping;
+		detachCachedScene((aiScene*)scene, begin, begin + cachedScenes[i].mappingSize);
+		delete scene;
+		munmap(cachedScenes[i].mapping, cachedScenes[i].mappingSize);
+		cachedScenes.erase(cachedScenes.begin() + i);
+		return;
+	}
+	aiReleaseImport(scene);
+}
@@ -0,0 +1,254 @@
+// ----------------------------------------------------------------------------
+// Offline batch rendering
+//
+// Renders without a window or display: an EGL context on Mesa's surfaceless
+// platform when available (software rasterized with llvmpipe if there is no
+// GPU), otherwise on the default display. Frames are drawn into a framebuffer
+// object and read back through a ring of pixel buffer objects: glReadPixels
+// into a PBO returns at once, and the PBO is only mapped when its slot comes
+// round again, by which time the copy has finished. The mapped pixels are
+// handed to encoder tasks that write them as PNG files, so rendering, readback
+// and encoding overlap. At most maxEncodes frames are being encoded at a time;
+// failed writes are reported by the render thread as it collects the tasks.
+//-----------------------------------------------------------------------------
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <zlib.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <cstdio>
+
+#define BATCH_RING_SIZE 3 //Pixel buffer objects in the readback ring
+
+struct BatchRenderer
+{
+	int width, height;
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
+	GLuint fbo, colourBuffer, depthBuffer;
+	GLuint pbos[BATCH_RING_SIZE];
+	GLsync fences[BATCH_RING_SIZE];
+	std::string paths[BATCH_RING_SIZE]; //File of the frame in each slot, empty if the slot is free
+	int nextSlot;
+	std::deque< std::future<bool> > encodes;
+	std::deque<std::string> encodePaths; //File written by each encode task
+	int maxEncodes;
+	long framesWritten, failures;
+	double readbackWaitMs, encodeWaitMs; //Time the render loop spent blocked
+};
+
+// ----------------------------------------------------------------------------
+// PNG writing: 8-bit RGB, each row with the Up filter, deflated by zlib
+void appendPNGChunk(std::vector<unsigned char>* out, const char* type, const unsigned char* data, size_t size)
+{
+	unsigned char length[4] = { (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8),
+		(unsigned char)size };
+	out->insert(out->end(), length, length + 4);
+	size_t start = out->size();
+	out->insert(out->end(), type, type + 4);
+	out->insert(out->end(), data, data + size);
+	uLong crc = crc32(0L, &(*out)[start], size + 4);
+	unsigned char crcBytes[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8),
+		(unsigned char)crc };
+	out->insert(out->end(), crcBytes, crcBytes + 4);
+}
+
+// rgba holds the rows bottom-up, as read back by glReadPixels
+bool writePNG(const char* path, const unsigned char* rgba, int width, int height)
+{
+	size_t rowBytes = width * 3 + 1;
+	std::vector<unsigned char> raw(rowBytes * height);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* src = rgba + (size_t)(height - 1 - y) * width * 4;
+		const unsigned char* above = y > 0 ? rgba + (size_t)(height - y) * width * 4 : NULL;
+		unsigned char* dst = &raw[y * rowBytes];
+		dst[0] = 2; //Up
+		for (int x = 0; x < width; x++)
+			for (int c = 0; c < 3; c++)
+				dst[1 + x * 3 + c] = src[x * 4 + c] - (above != NULL ? above[x * 4 + c] : 0);
+	}
+	uLongf packedSize = compressBound(raw.size());
+	std::vector<unsigned char> packed(packedSize);
+	if (compress2(packed.data(), &packedSize, raw.data(), raw.size(), 3) != Z_OK) return false;
+
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	unsigned char header[13] = { (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8),
+		(unsigned char)width, (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8),
+		(unsigned char)height, 8, 2, 0, 0, 0 }; //8 bits, RGB, deflate, adaptive filtering, no interlace
+	std::vector<unsigned char> png(signature, signature + 8);
+	appendPNGChunk(&png, "IHDR", header, sizeof(header));
+	appendPNGChunk(&png, "IDAT", packed.data(), packedSize);
+	appendPNGChunk(&png, "IEND", NULL, 0);
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL) return false;
+	bool ok = fwrite(png.data(), 1, png.size(), fp) == png.size();
+	return fclose(fp) == 0 && ok;
+}
+
+// ----------------------------------------------------------------------------
+// Creates a compatibility profile GL context (the renderer uses the
+// fixed-function pipeline) with no window, and makes it current
+bool createHeadlessContext(BatchRenderer* r)
+{
+	r->display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	if (getPlatformDisplay != NULL)
+		r->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#endif
+	EGLint major, minor;
+	if (r->display == EGL_NO_DISPLAY || !eglInitialize(r->display, &major, &minor))
+	{
+		r->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (r->display == EGL_NO_DISPLAY || !eglInitialize(r->display, &major, &minor))
+		{
+			cout << "No EGL display" << endl;
+			return false;
+		}
+	}
+	const EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE };
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(r->display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0 || !eglBindAPI(EGL_OPENGL_API))
+	{
+		cout << "No EGL configuration for desktop OpenGL" << endl;
+		return false;
+	}
+	const EGLint contextAttribs[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE };
+	r->context = eglCreateContext(r->display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (r->context == EGL_NO_CONTEXT) r->context = eglCreateContext(r->display, config, EGL_NO_CONTEXT, NULL);
+	if (r->context == EGL_NO_CONTEXT)
+	{
+		cout << "Couldn't create an EGL context" << endl;
+		return false;
+	}
+	//Frames go to a framebuffer object; the surface only has to exist
+	const EGLint surfaceAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+	r->surface = eglCreatePbufferSurface(r->display, config, surfaceAttribs);
+	if (!eglMakeCurrent(r->display, r->surface, r->surface, r->context))
+	{
+		cout << "Couldn't make the EGL context current" << endl;
+		return false;
+	}
+	cout << "Headless rendering with EGL " << major << "." << minor << endl;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// The framebuffer object frames are drawn into and the readback ring. Needs
+// the GL entry points (glewInit()).
+bool createBatchTargets(BatchRenderer* r, int width, int height, int maxEncodes)
+{
+	r->width = width;
+	r->height = height;
+	glGenRenderbuffers(1, &r->colourBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, r->colourBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &r->depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, r->depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glGenFramebuffers(1, &r->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, r->colourBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, r->depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cout << "Batch render framebuffer is incomplete" << endl;
+		return false;
+	}
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glViewport(0, 0, width, height);
+
+	glGenBuffers(BATCH_RING_SIZE, r->pbos);
+	for (int s = 0; s < BATCH_RING_SIZE; s++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[s]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+		r->fences[s] = 0;
+		r->paths[s].clear();
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	r->nextSlot = 0;
+	r->maxEncodes = maxEncodes < 1 ? 1 : maxEncodes;
+	r->framesWritten = r->failures = 0;
+	r->readbackWaitMs = r->encodeWaitMs = 0;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Waits for the oldest encode task
+void finishOldestEncode(BatchRenderer* r)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	if (r->encodes.front().get()) r->framesWritten++;
+	else
+	{
+		cout << "Couldn't write " << r->encodePaths.front() << endl;
+		r->failures++;
+	}
+	r->encodes.pop_front();
+	r->encodePaths.pop_front();
+	r->encodeWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Maps the PBO of a slot once its readback has finished and hands a copy of
+// the pixels to an encoder task
+void completeSlot(BatchRenderer* r, int s)
+{
+	if (r->paths[s].empty()) return;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	while (glClientWaitSync(r->fences[s], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+	glDeleteSync(r->fences[s]);
+	size_t size = (size_t)r->width * r->height * 4;
+	std::shared_ptr< std::vector<unsigned char> > pixels(new std::vector<unsigned char>(size));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[s]);
+	const void* mapped = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (mapped != NULL) memcpy(pixels->data(), mapped, size);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	r->readbackWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+	while ((int)r->encodes.size() >= r->maxEncodes) finishOldestEncode(r);
+	std::string path = r->paths[s];
+	int width = r->width, height = r->height;
+	bool ok = mapped != NULL;
+	r->encodes.push_back(std::async(std::launch::async, [pixels, path, width, height, ok] {
+		return ok && writePNG(path.c_str(), pixels->data(), width, height);
+	}));
+	r->encodePaths.push_back(path);
+	r->paths[s].clear();
+}
+
+// Starts the readback of the frame just drawn, to be written to path
+void readBatchFrame(BatchRenderer* r, const std::string& path)
+{
+	int s = r->nextSlot;
+	completeSlot(r, s);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[s]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, r->width, r->height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	r->fences[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	r->paths[s] = path;
+	r->nextSlot = (s + 1) % BATCH_RING_SIZE;
+}
+
+// Completes every readback in the ring and waits for all encode tasks
+void finishBatchFrames(BatchRenderer* r)
+{
+	for (int k = 0; k < BATCH_RING_SIZE; k++) completeSlot(r, (r->nextSlot + k) % BATCH_RING_SIZE);
+	while (!r->encodes.empty()) finishOldestEncode(r);
+}
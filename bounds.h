@@ -0,0 +1,179 @@
+// ----------------------------------------------------------------------------
+// Animated bounding boxes and frustum culling
+//
+// At load time every bone of a mesh gets the bind-space box of the vertices
+// it influences (vertices without weights go into a separate rigid box). A
+// skinned vertex is a weighted average of its bones' transforms of the bind
+// vertex, so it lies inside the union of the bone boxes transformed by the
+// current palette. That gives a conservative box per mesh and per character
+// for the cost of a few matrix-box products per bone, without touching a
+// vertex. Boxes are transformed with the absolute-matrix method (centre and
+// half extent), and tested against the view frustum in clip space.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cmath>
+
+struct Box
+{
+	aiVector3D min, max;
+
+	Box() : min(1e10f, 1e10f, 1e10f), max(-1e10f, -1e10f, -1e10f) {}
+	bool empty() const { return min.x > max.x; }
+};
+
+struct SkinBounds
+{
+	std::vector< std::vector<Box> > bone; //Per mesh, per bone: bind-space box of the influenced vertices
+	std::vector<Box> rigid;               //Per mesh: box of the vertices without weights
+};
+
+// ----------------------------------------------------------------------------
+void growBox(Box* box, const aiVector3D& p)
+{
+	box->min.x = aisgl_min(box->min.x, p.x); box->max.x = aisgl_max(box->max.x, p.x);
+	box->min.y = aisgl_min(box->min.y, p.y); box->max.y = aisgl_max(box->max.y, p.y);
+	box->min.z = aisgl_min(box->min.z, p.z); box->max.z = aisgl_max(box->max.z, p.z);
+}
+
+void unionBox(Box* box, const Box& b)
+{
+	if (b.empty()) return;
+	growBox(box, b.min);
+	growBox(box, b.max);
+}
+
+// ----------------------------------------------------------------------------
+// Box around the affine transform of a box
+Box transformBox(const aiMatrix4x4& m, const Box& b)
+{
+	Box out;
+	if (b.empty()) return out;
+	aiVector3D c = (b.min + b.max) * 0.5f, e = (b.max - b.min) * 0.5f;
+	aiVector3D tc = m * c;
+	aiVector3D te(fabs(m.a1) * e.x + fabs(m.a2) * e.y + fabs(m.a3) * e.z,
+		fabs(m.b1) * e.x + fabs(m.b2) * e.y + fabs(m.b3) * e.z,
+		fabs(m.c1) * e.x + fabs(m.c2) * e.y + fabs(m.c3) * e.z);
+	out.min = tc - te;
+	out.max = tc + te;
+	return out;
+}
+
+// ----------------------------------------------------------------------------
+// True if the box is entirely outside one of the planes of the view frustum.
+// toClip maps the box's space to clip space.
+bool boxOutsideFrustum(const aiMatrix4x4& toClip, const Box& b)
+{
+	if (b.empty()) return true;
+	int outside[6] = { 0 };
+	for (int c = 0; c < 8; c++)
+	{
+		aiVector3D p((c & 1) ? b.max.x : b.min.x, (c & 2) ? b.max.y : b.min.y, (c & 4) ? b.max.z : b.min.z);
+		float x = toClip.a1 * p.x + toClip.a2 * p.y + toClip.a3 * p.z + toClip.a4;
+		float y = toClip.b1 * p.x + toClip.b2 * p.y + toClip.b3 * p.z + toClip.b4;
+		float z = toClip.c1 * p.x + toClip.c2 * p.y + toClip.c3 * p.z + toClip.c4;
+		float w = toClip.d1 * p.x + toClip.d2 * p.y + toClip.d3 * p.z + toClip.d4;
+		outside[0] += x < -w; outside[1] += x > w;
+		outside[2] += y < -w; outside[3] += y > w;
+		outside[4] += z < -w; outside[5] += z > w;
+	}
+	for (int k = 0; k < 6; k++)
+		if (outside[k] == 8) return true;
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+// Size in pixels of the larger side of the screen rectangle around a box, for
+// a square viewport of the given height. A box reaching behind the eye is
+// taken to fill the view.
+float projectedSize(const aiMatrix4x4& toClip, const Box& b, float viewportHeight)
+{
+	if (b.empty()) return 0;
+	float minX = 1e10f, maxX = -1e10f, minY = 1e10f, maxY = -1e10f;
+	for (int c = 0; c < 8; c++)
+	{
+		aiVector3D p((c & 1) ? b.max.x : b.min.x, (c & 2) ? b.max.y : b.min.y, (c & 4) ? b.max.z : b.min.z);
+		float x = toClip.a1 * p.x + toClip.a2 * p.y + toClip.a3 * p.z + toClip.a4;
+		float y = toClip.b1 * p.x + toClip.b2 * p.y + toClip.b3 * p.z + toClip.b4;
+		float w = toClip.d1 * p.x + toClip.d2 * p.y + toClip.d3 * p.z + toClip.d4;
+		if (w <= 1e-6f) return 1e10f;
+		minX = aisgl_min(minX, x / w); maxX = aisgl_max(maxX, x / w);
+		minY = aisgl_min(minY, y / w); maxY = aisgl_max(maxY, y / w);
+	}
+	return aisgl_max(maxX - minX, maxY - minY) * 0.5f * viewportHeight;
+}
+
+// ----------------------------------------------------------------------------
+// Appends the bind-space boxes of the bones of the next mesh, from the
+// influences kept in its skin table
+void addMeshBounds(const SkinTable* table, const aiVector3D* bindVerts, int numBones, SkinBounds* bounds)
+{
+	bounds->bone.push_back(std::vector<Box>(numBones));
+	bounds->rigid.push_back(Box());
+	std::vector<Box>& bone = bounds->bone.back();
+	for (int i = 0; i < table->numVertices; i++)
+	{
+		const unsigned short* bi = &table->bones[i * MAX_INFLUENCES];
+		const float* wi = &table->weights[i * MAX_INFLUENCES];
+		if (wi[0] == 0) growBox(&bounds->rigid.back(), bindVerts[i]);
+		for (int k = 0; k < MAX_INFLUENCES; k++)
+			if (wi[k] > 0) growBox(&bone[bi[k]], bindVerts[i]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Box of mesh m in the space of its skinned vertices for the given palette
+Box animatedMeshBox(const SkinBounds* bounds, int m, const aiMatrix4x4* palette)
+{
+	Box box = bounds->rigid[m];
+	for (unsigned int b = 0; b < bounds->bone[m].size(); b++)
+		unionBox(&box, transformBox(palette[b], bounds->bone[m][b]));
+	return box;
+}
+
+// ----------------------------------------------------------------------------
+// Boxes of every mesh and of the whole character in the scene's root space,
+// for the pose in skel's globals and palettes (see evaluateBonePalettes()).
+// A mesh drawn by several nodes gets the union of its boxes.
+void animatedBounds(const aiScene* scene, const Skeleton* skel, const SkinBounds* bounds,
+	std::vector<Box>* meshBoxes, Box* character)
+{
+	meshBoxes->assign(scene->mNumMeshes, Box());
+	*character = Box();
+	std::vector<Box> local(scene->mNumMeshes);
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+		local[m] = animatedMeshBox(bounds, m, skel->palette[m].data());
+	for (int n = 0; n < skel->numNodes; n++)
+	{
+		const aiNode* node = skel->nodes[n];
+		for (unsigned int k = 0; k < node->mNumMeshes; k++)
+		{
+			int m = node->mMeshes[k];
+			Box box = transformBox(skel->global[n], local[m]);
+			unionBox(&(*meshBoxes)[m], box);
+			unionBox(character, box);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Row-major equivalents of gluPerspective() and gluLookAt()
+aiMatrix4x4 perspectiveMatrix(float fovy, float aspect, float zNear, float zFar)
+{
+	float f = 1 / tan(fovy * AI_MATH_PI_F / 360);
+	return aiMatrix4x4(f / aspect, 0, 0, 0,
+		0, f, 0, 0,
+		0, 0, (zFar + zNear) / (zNear - zFar), 2 * zFar * zNear / (zNear - zFar),
+		0, 0, -1, 0);
+}
+
+aiMatrix4x4 lookAtMatrix(const aiVector3D& eye, const aiVector3D& centre, const aiVector3D& up)
+{
+	aiVector3D f = (centre - eye).Normalize();
+	aiVector3D s = (f ^ up).Normalize();
+	aiVector3D u = s ^ f;
+	return aiMatrix4x4(s.x, s.y, s.z, -(s * eye),
+		u.x, u.y, u.z, -(u * eye),
+		-f.x, -f.y, -f.z, f * eye,
+		0, 0, 0, 1);
+}
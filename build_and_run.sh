@@ -1,4 +1,7 @@
 #!/bin/bash
-g++ -Wall -o Assignment Assignment.cpp -lGL -lGLU -lglut -lGLEW -lassimp -lIL
+# PROFILE=1 ./build_and_run.sh builds the viewer with the frame profiler (see profiler.h)
+if [ "$PROFILE" = "1" ]; then PROFILE_FLAGS="-DENABLE_PROFILER"; fi
+g++ -Wall -pthread $PROFILE_FLAGS -o Assignment Assignment.cpp -lGL -lGLU -lglut -lGLEW -lassimp -lIL -lpng -ljpeg -lEGL -lz
+g++ -Wall -O2 -pthread -o Benchmark Benchmark.cpp -lassimp
+g++ -Wall -O2 -o KeyframeBench KeyframeBench.cpp
 ./Assignment
-
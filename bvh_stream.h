@@ -0,0 +1,392 @@
+// ----------------------------------------------------------------------------
+// Streaming BVH reader
+//
+// Plays BVH motion of any length in constant memory, in place of importing it
+// with assimp (which converts every frame into key arrays first). The
+// HIERARCHY is parsed once; the file is memory-mapped and MOTION lines are
+// decoded on demand into a window of consecutive frames. Sequential playback
+// refills the window from where the previous one ended; a seek walks lines
+// forward from the nearest entry of a frame-offset index. The index holds at
+// most BVH_INDEX_ENTRIES offsets and is thinned out (its stride doubled) when
+// full, so its size does not grow with the file either. Pages of the mapping
+// behind the window are given back after each refill.
+//
+// The stream presents the clip as an aiAnimation with one channel per joint,
+// named and ordered as assimp's BVH importer does, but without keys; the
+// joints are sampled with sampleBVHStream(), which matches sampleChannel() on
+// the imported keys.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BVH_INDEX_ENTRIES 4096 //Entries of the seek index before it is thinned out
+
+enum BVHChannel { BVH_XPOSITION, BVH_YPOSITION, BVH_ZPOSITION, BVH_XROTATION, BVH_YROTATION, BVH_ZROTATION };
+
+struct BVHJoint
+{
+	std::string name;
+	aiVector3D offset;
+	int firstValue;                   //Index of the joint's first channel in a frame line
+	std::vector<unsigned char> channels; //BVHChannel, in file order
+	bool hasPosition;
+};
+
+struct BVHStream
+{
+	std::vector<BVHJoint> joints; //ROOT and JOINTs in file order (End Sites have no channels)
+	int valuesPerFrame;
+	long numFrames;
+	double frameTime;
+	aiAnimation* animation;       //Channel names, duration and rate; no keys
+
+	const char* data;             //Mapping of the whole file
+	size_t size;
+	size_t motionStart;           //Offset of the first frame line
+
+	std::vector<size_t> seekIndex; //Offset of every indexStride'th frame, from frame 0
+	long indexStride;
+	long scannedFrame;            //Furthest frame whose line offset is known
+	size_t scannedOffset;
+
+	int windowFrames;             //Capacity of the window
+	long windowFirst;             //First frame held, and the number held
+	int windowCount;
+	std::vector<aiVector3D> positions;  //windowFrames x joints
+	std::vector<aiQuaternion> rotations;
+	std::vector<size_t> windowOffsets;  //Line offset of each frame held, and of the one after
+	size_t touchedFrom;           //Start of the pages read since they were last given back
+	std::vector<float> values;    //Scratch for one frame line
+	std::string line;
+	long refills;
+	bool truncated;               //Reported once if the file has fewer lines than Frames:
+
+	BVHStream() : valuesPerFrame(0), numFrames(0), frameTime(0), animation(NULL), data(NULL), size(0), motionStart(0),
+		indexStride(1), scannedFrame(0), scannedOffset(0), windowFrames(0), windowFirst(0), windowCount(0),
+		touchedFrom(0), refills(0), truncated(false) {}
+};
+
+// ----------------------------------------------------------------------------
+// Whitespace-separated tokens of the header
+struct BVHTokens
+{
+	const char* p;
+	const char* end;
+
+	std::string next()
+	{
+		while (p < end && isspace((unsigned char)*p)) p++;
+		const char* start = p;
+		while (p < end && !isspace((unsigned char)*p)) p++;
+		return std::string(start, p);
+	}
+	float number()
+	{
+		return (float)atof(next().c_str());
+	}
+};
+
+// ----------------------------------------------------------------------------
+// Parses a ROOT or JOINT block (its name is the next token) with its children.
+// End Sites are skipped: they have no channels and assimp gives them none.
+bool parseBVHJoint(BVHTokens* t, BVHStream* s)
+{
+	BVHJoint joint;
+	joint.name = t->next();
+	joint.firstValue = s->valuesPerFrame;
+	joint.hasPosition = false;
+	if (t->next() != "{") return false;
+	int index = s->joints.size();
+	s->joints.push_back(joint);
+	while (true)
+	{
+		std::string token = t->next();
+		if (token == "}") return true;
+		if (token == "OFFSET")
+		{
+			float x = t->number(), y = t->number(), z = t->number();
+			s->joints[index].offset = aiVector3D(x, y, z);
+		}
+		else if (token == "CHANNELS")
+		{
+			int n = atoi(t->next().c_str());
+			const char* names[6] = { "Xposition", "Yposition", "Zposition", "Xrotation", "Yrotation", "Zrotation" };
+			for (int k = 0; k < n; k++)
+			{
+				std::string name = t->next();
+				int c = 0;
+				while (c < 6 && name != names[c]) c++;
+				if (c == 6) return false;
+				s->joints[index].channels.push_back(c);
+				if (c <= BVH_ZPOSITION) s->joints[index].hasPosition = true;
+			}
+			s->valuesPerFrame += n;
+		}
+		else if (token == "JOINT")
+		{
+			if (!parseBVHJoint(t, s)) return false;
+		}
+		else if (token == "End")
+		{
+			t->next(); //Site
+			if (t->next() != "{") return false;
+			while (t->p < t->end && t->next() != "}") {}
+		}
+		else return false;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// The keyless clip the rest of the program sees: assimp's channel per joint,
+// duration (frames - 1 ticks) and rate (one tick per frame)
+aiAnimation* createBVHAnimation(const BVHStream* s)
+{
+	aiAnimation* anim = new aiAnimation();
+	anim->mDuration = (double)(s->numFrames - 1);
+	anim->mTicksPerSecond = 1.0 / s->frameTime;
+	anim->mNumChannels = s->joints.size();
+	anim->mChannels = new aiNodeAnim*[anim->mNumChannels];
+	for (unsigned int j = 0; j < anim->mNumChannels; j++)
+	{
+		anim->mChannels[j] = new aiNodeAnim();
+		anim->mChannels[j]->mNodeName.Set(s->joints[j].name);
+	}
+	return anim;
+}
+
+// ----------------------------------------------------------------------------
+// Maps the file and parses its header. Returns false (and prints why) if the
+// file can't be read or isn't BVH.
+bool openBVHStream(const char* path, int windowFrames, BVHStream* s)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		if (fd >= 0) close(fd);
+		cout << "Couldn't read " << path << endl;
+		return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		cout << "Couldn't map " << path << endl;
+		return false;
+	}
+	s->data = (const char*)data;
+	s->size = st.st_size;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	BVHTokens t = { s->data, s->data + s->size };
+	bool ok = t.next() == "HIERARCHY" && t.next() == "ROOT" && parseBVHJoint(&t, s);
+	ok = ok && t.next() == "MOTION" && t.next() == "Frames:";
+	if (ok) s->numFrames = atol(t.next().c_str());
+	ok = ok && t.next() == "Frame" && t.next() == "Time:";
+	if (ok) s->frameTime = t.number();
+	if (!ok || s->numFrames < 1 || s->frameTime <= 0)
+	{
+		cout << path << " is not a BVH file this reader understands" << endl;
+		munmap(data, st.st_size);
+		s->data = NULL;
+		return false;
+	}
+	const char* eol = (const char*)memchr(t.p, '\n', t.end - t.p);
+	s->motionStart = eol != NULL ? eol + 1 - s->data : s->size;
+
+	s->seekIndex.assign(1, s->motionStart);
+	s->indexStride = 1;
+	s->scannedFrame = 0;
+	s->scannedOffset = s->motionStart;
+	s->windowFrames = aisgl_max(windowFrames, 2);
+	s->windowFirst = 0;
+	s->windowCount = 0;
+	s->positions.resize(s->windowFrames * s->joints.size());
+	s->rotations.resize(s->windowFrames * s->joints.size());
+	s->windowOffsets.resize(s->windowFrames + 1);
+	s->touchedFrom = s->motionStart;
+	s->values.resize(s->valuesPerFrame);
+	s->animation = createBVHAnimation(s);
+	return true;
+}
+
+// Unmaps the file and frees the stream's animation
+void closeBVHStream(BVHStream* s)
+{
+	if (s->data != NULL) munmap((void*)s->data, s->size);
+	s->data = NULL;
+	delete s->animation;
+	s->animation = NULL;
+}
+
+// Memory held by a stream (not counting the mapping, whose pages come and go)
+size_t bvhStreamBytes(const BVHStream* s)
+{
+	return s->positions.size() * sizeof(aiVector3D) + s->rotations.size() * sizeof(aiQuaternion)
+		+ s->windowOffsets.size() * sizeof(size_t) + s->seekIndex.capacity() * sizeof(size_t)
+		+ s->values.size() * sizeof(float) + s->line.capacity();
+}
+
+// ----------------------------------------------------------------------------
+// Offset of the line after the one at offset (the end of the file if none)
+size_t nextBVHLine(const BVHStream* s, size_t offset)
+{
+	const char* eol = (const char*)memchr(s->data + offset, '\n', s->size - offset);
+	return eol != NULL ? eol + 1 - s->data : s->size;
+}
+
+// Records that a frame's line starts at offset, adding it to the seek index
+// if it falls on the stride. A full index drops every other entry.
+void noteBVHFrame(BVHStream* s, long frame, size_t offset)
+{
+	if (frame <= s->scannedFrame) return;
+	s->scannedFrame = frame;
+	s->scannedOffset = offset;
+	if (frame % s->indexStride != 0 || frame / s->indexStride != (long)s->seekIndex.size()) return;
+	if (s->seekIndex.size() == BVH_INDEX_ENTRIES)
+	{
+		for (unsigned int k = 0; k < BVH_INDEX_ENTRIES / 2; k++) s->seekIndex[k] = s->seekIndex[2 * k];
+		s->seekIndex.resize(BVH_INDEX_ENTRIES / 2);
+		s->indexStride *= 2;
+		if (frame % s->indexStride != 0) return;
+	}
+	s->seekIndex.push_back(offset);
+}
+
+// Offset of the line of a frame, walking forward from the nearest known one
+size_t findBVHFrame(BVHStream* s, long frame)
+{
+	long k = aisgl_min(frame / s->indexStride, (long)s->seekIndex.size() - 1);
+	long f = k * s->indexStride;
+	size_t offset = s->seekIndex[k];
+	if (s->scannedFrame > f && s->scannedFrame <= frame)
+	{
+		f = s->scannedFrame;
+		offset = s->scannedOffset;
+	}
+	s->touchedFrom = aisgl_min(s->touchedFrom, offset);
+	for (; f < frame && offset < s->size; f++)
+	{
+		offset = nextBVHLine(s, offset);
+		noteBVHFrame(s, f + 1, offset);
+	}
+	return offset;
+}
+
+// ----------------------------------------------------------------------------
+// Decodes the frame line at offset into slot w of the window, as assimp
+// converts it: the position channels (or the joint's offset if it has none)
+// and the product of the rotation channels in file order. A missing line
+// repeats the previous frame.
+void decodeBVHFrame(BVHStream* s, size_t offset, int w)
+{
+	int numJoints = s->joints.size();
+	size_t end = nextBVHLine(s, offset);
+	s->line.assign(s->data + offset, end - offset);
+	const char* p = s->line.c_str();
+	int n = 0;
+	for (char* next; n < s->valuesPerFrame; n++, p = next)
+	{
+		s->values[n] = strtof(p, &next);
+		if (next == p) break;
+	}
+	if (n < s->valuesPerFrame)
+	{
+		if (!s->truncated) cout << "BVH stream: frame lines end before frame " << s->windowFirst + w << endl;
+		s->truncated = true;
+		for (int j = 0; j < numJoints; j++)
+		{
+			s->positions[w * numJoints + j] = w > 0 ? s->positions[(w - 1) * numJoints + j] : s->joints[j].offset;
+			s->rotations[w * numJoints + j] = w > 0 ? s->rotations[(w - 1) * numJoints + j] : aiQuaternion();
+		}
+		return;
+	}
+	for (int j = 0; j < numJoints; j++)
+	{
+		const BVHJoint& joint = s->joints[j];
+		aiVector3D position = joint.hasPosition ? aiVector3D() : joint.offset;
+		aiMatrix3x3 rotation;
+		aiMatrix4x4 temp;
+		for (unsigned int c = 0; c < joint.channels.size(); c++)
+		{
+			float value = s->values[joint.firstValue + c];
+			float angle = value * float(AI_MATH_PI) / 180.0f;
+			switch (joint.channels[c])
+			{
+			case BVH_XPOSITION: position.x = value; break;
+			case BVH_YPOSITION: position.y = value; break;
+			case BVH_ZPOSITION: position.z = value; break;
+			case BVH_XROTATION: rotation *= aiMatrix3x3(aiMatrix4x4::RotationX(angle, temp)); break;
+			case BVH_YROTATION: rotation *= aiMatrix3x3(aiMatrix4x4::RotationY(angle, temp)); break;
+			case BVH_ZROTATION: rotation *= aiMatrix3x3(aiMatrix4x4::RotationZ(angle, temp)); break;
+			}
+		}
+		s->positions[w * numJoints + j] = position;
+		s->rotations[w * numJoints + j] = aiQuaternion(rotation);
+	}
+}
+
+// Fills the window with the frames from first on, then gives back the pages
+// read before the window
+void refillBVHWindow(BVHStream* s, long first)
+{
+	PROFILE_SCOPE("refillBVHWindow");
+	size_t offset;
+	if (first >= s->windowFirst && first <= s->windowFirst + s->windowCount && s->windowCount > 0)
+		offset = s->windowOffsets[first - s->windowFirst];
+	else
+		offset = findBVHFrame(s, first);
+	s->windowFirst = first;
+	s->windowCount = aisgl_min((long)s->windowFrames, s->numFrames - first);
+	for (int w = 0; w < s->windowCount; w++)
+	{
+		s->windowOffsets[w] = offset;
+		decodeBVHFrame(s, offset, w);
+		offset = nextBVHLine(s, offset);
+		noteBVHFrame(s, first + w + 1, offset);
+	}
+	s->windowOffsets[s->windowCount] = offset;
+	s->refills++;
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = (s->touchedFrom + page - 1) & ~(page - 1);
+	size_t end = s->windowOffsets[0] & ~(page - 1);
+	if (end > begin) madvise((void*)(s->data + begin), end - begin, MADV_DONTNEED);
+	s->touchedFrom = s->windowOffsets[0];
+}
+
+// ----------------------------------------------------------------------------
+// Local transform of a joint at the given tick, as sampleChannel() computes
+// it from the imported keys (without stepRotation): the position of the first
+// frame at or after the tick, the rotation slerped from the frame before it.
+aiMatrix4x4 sampleBVHStream(BVHStream* s, int joint, double tick)
+{
+	long last = s->numFrames - 1;
+	long frame = aisgl_min((long)ceil(aisgl_max(tick, 0.0)), last);
+	long prev = frame > 0 ? frame - 1 : frame;
+	if (prev < s->windowFirst || frame >= s->windowFirst + s->windowCount) refillBVHWindow(s, prev);
+
+	int numJoints = s->joints.size();
+	int w = frame - s->windowFirst;
+	aiMatrix4x4 matPos;
+	aiMatrix4x4::Translation(s->positions[w * numJoints + joint], matPos);
+	aiQuaternion rotn = s->rotations[w * numJoints + joint];
+	if (frame > 0)
+	{
+		aiQuatKey keys[2];
+		keys[0].mTime = frame - 1;
+		keys[0].mValue = s->rotations[(w - 1) * numJoints + joint];
+		keys[1].mTime = frame;
+		keys[1].mValue = rotn;
+		rotn = interpolateRotation(keys, 2, 1, tick);
+	}
+	return matPos * aiMatrix4x4(rotn.GetMatrix());
+}
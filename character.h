@@ -0,0 +1,587 @@
+// ----------------------------------------------------------------------------
+// Character animation
+//
+// Model loading, animation and skinning state shared by the viewer
+// (Assignment.cpp) and the headless benchmark (Benchmark.cpp). Nothing in
+// here needs a GL context.
+//-----------------------------------------------------------------------------
+
+#include <string>
+#include <map>
+#include <chrono>
+#include <future>
+#include <cmath>
+#include <algorithm>
+#include "profiler.h"
+#include "skeleton.h"
+#include "asset_cache.h"
+#include "compact_mesh.h"
+#include "skinning.h"
+#include "lod.h"
+#include "thread_pool.h"
+#include "keyframes.h"
+#include "clip_compression.h"
+#include "pose_cache.h"
+#include "bounds.h"
+#include "retarget.h"
+#include "bvh_stream.h"
+#include "frame_cache.h"
+
+//----------Globals----------------------------
+const aiScene* scenes[3] = {NULL};
+aiAnimation* animations[4] = {NULL};
+int curr_scene = 0;
+aiVector3D scene_min[3], scene_max[3], scene_center[3];
+RetargetMap retargets[3]; //Companion clip of a character mapped onto its own clip (dwarf: the BVH walk)
+
+bool dwarf_2 = false;
+
+int tDuration[4]; //Animation duration in ticks.
+double currTick[4] = {0}; //current (fractional) tick
+float timeStep = 50; //Animation time step = 50 m.sec. per tick, unless nativeTickRate
+bool nativeTickRate = false; //Play clips at their own ticks per second (--native-rate)
+bool useFrameCache = false; //Keep skinned frames of the loops, see frame_cache.h (--frame-cache[=<MB>])
+
+std::vector<CompactMesh> compactMeshes[3]; //Quantized bind pose, texture coordinates and indices of every mesh
+Skeleton skeletons[3];
+std::vector<SkinTable> skinTables[3]; //Per-vertex bone influences of each mesh
+SkinningKernel skinKernel = SKIN_SCALAR; //Selected with --skinning=<name> or cycled with 'k'
+std::vector<SkinChunk> skinChunks[3]; //Vertex ranges skinned in parallel
+std::vector< std::vector<MeshLevel> > meshLevels[3]; //Levels of detail of every mesh, see lod.h
+int lodLevel[3] = {0}; //Level each scene is drawn at (the meshes' coarsest if they have fewer)
+int skinnedLevel[3] = {0}; //Level of the last skinning pass of each scene
+bool useLOD = true; //Select levels by screen size ('l', --no-lod)
+float lodPixels = 200; //Screen height (pixels) down to which the full meshes are used (--lod-pixels=<n>)
+SkinBounds skinBounds[3]; //Bind-space bone boxes for the animated bounds
+std::vector<char> meshVisible[3]; //Meshes to skin (inside the view frustum), all when empty
+std::vector<char> meshStale[3]; //Meshes left out of the last skinning pass
+ThreadPool* pool = NULL; //Skinning workers, see startWorkers()
+int numThreads = 0; //Size of the worker pool, 0 = one per core (--threads=<n>)
+std::vector<int> channelNodes[4]; //Channel -> skeleton node index for each animation
+std::vector<KeyCursor> keyCursors[4]; //Per-channel keyframe cursors for each animation
+const char* animFiles[4] = {NULL}; //File each animation was loaded from
+BakedClip bakedClips[4]; //Animations sampled at a fixed rate, see --bake
+bool useBakedPoses = false; //Toggled with 'b' once the clips are baked
+float bakeRate = 1; //Baked frames per animation tick
+CompressedClip compressedClips[4]; //Animations with redundant keys removed, see --compress-clips
+bool useCompressedClips = false;
+float clipPositionError = 0.001f; //Error bounds of the compression: model units
+float clipAngleError = 0.1f;      //and degrees
+const char* modelFiles[3] = { "ArmyPilot.x", "mannequin.fbx", "dwarf.x" }; //<<<-------------Specify input file names here
+const char* companionFiles[3] = { NULL, "run.fbx", "avatar_walk.bvh" }; //Animation files loaded with each model
+bool useAssetCache = true; //Import through <file>.aicache (--no-asset-cache to bypass)
+BVHStream* bvhStreams[4] = {NULL}; //Animations played from a streaming BVH reader instead of imported keys
+bool streamBVH = false; //Stream BVH companion files (--stream-bvh[=<window frames>])
+int bvhWindowFrames = 256; //Frames decoded at a time by a BVH stream
+
+//-------Loads model data from file and creates a scene object----------
+const aiScene* importAsset(const char* fileName)
+{
+	unsigned int flags = aiProcessPreset_TargetRealtime_MaxQuality;
+	return useAssetCache ? importCached(fileName, flags) : aiImportFile(fileName, flags);
+}
+
+// Closes the stream an animation is played from, if any
+void releaseBVHStream(int a)
+{
+	if (bvhStreams[a] == NULL) return;
+	if (animations[a] == bvhStreams[a]->animation) animations[a] = NULL;
+	closeBVHStream(bvhStreams[a]);
+	delete bvhStreams[a];
+	bvhStreams[a] = NULL;
+}
+
+void releaseBVHStreams()
+{
+	for (int a = 0; a < 4; a++) releaseBVHStream(a);
+}
+
+// Every character only writes its own slots of the globals above, so the
+// three can be loaded on separate threads. Returns false if the model or its
+// animation file can't be imported; the caller reports it.
+bool loadModel(const char* fileName, const char* anim_file, int index)
+{
+    PROFILE_SCOPE("loadModel");
+    std::future<const aiScene*> animImport; //The animation file is imported alongside the model
+    BVHStream* stream = NULL; //or streamed
+    if (anim_file != NULL && streamBVH && strstr(anim_file, ".bvh") != NULL)
+    {
+		stream = new BVHStream();
+		if (!openBVHStream(anim_file, bvhWindowFrames, stream))
+		{
+			delete stream;
+			stream = NULL;
+		}
+	}
+    if (anim_file != NULL && stream == NULL) animImport = std::async(std::launch::async, importAsset, anim_file);
+    const aiScene* scene = importAsset(fileName);
+    bool imported = animImport.valid();
+    const aiScene* q = imported ? animImport.get() : NULL;
+    if (scene == NULL || (imported && (q == NULL || !q->HasAnimations())))
+    {
+		if (stream != NULL)
+		{
+			closeBVHStream(stream);
+			delete stream;
+		}
+		return false;
+    }
+    if (scene->HasAnimations()) {
+		animations[index] = scene->mAnimations[0];
+		animFiles[index] = fileName;
+		tDuration[index] = scene->mAnimations[0]->mDuration;
+	}
+	buildSkeleton(scene, &skeletons[index]);
+	if (scene->HasAnimations())
+	{
+		resolveChannels(&skeletons[index], animations[index], &channelNodes[index]);
+		keyCursors[index].assign(animations[index]->mNumChannels, KeyCursor());
+	}
+	if (anim_file != NULL)
+	{
+		releaseBVHStream(index+((index+1)%2));
+		if (stream != NULL)
+		{
+			animations[index+((index+1)%2)] = stream->animation;
+			bvhStreams[index+((index+1)%2)] = stream;
+			cout << "Streaming " << anim_file << ": " << stream->joints.size() << " joints, " << stream->numFrames
+				<< " frames at " << 1 / stream->frameTime << " fps, " << bvhStreamBytes(stream) / 1024.0 << " KB" << endl;
+		}
+		else
+			animations[index+((index+1)%2)] = q->mAnimations[0];
+		animFiles[index+((index+1)%2)] = anim_file;
+		tDuration[index+((index+1)%2)] = animations[index+((index+1)%2)]->mDuration;
+		resolveChannels(&skeletons[index], animations[index+((index+1)%2)], &channelNodes[index+((index+1)%2)]);
+		keyCursors[index+((index+1)%2)].assign(animations[index+((index+1)%2)]->mNumChannels, KeyCursor());
+		if (index != index+((index+1)%2) && animations[index] != NULL)
+		{
+			string overrides = string(fileName) + ".retarget";
+			buildRetargetMap(animations[index], animations[index+((index+1)%2)], overrides.c_str(), &retargets[index]);
+			cout << "Retargeted " << anim_file << " onto " << fileName << ": " << retargets[index].numMapped
+				<< " joints" << endl;
+		}
+	}
+	
+	//The meshes are simplified (reordering their vertices), then the bind pose
+	//moves into the compact meshes; the imported positions and normals are
+	//kept as the skinning output
+	aiMesh* mesh;
+	size_t importedBytes = 0, compactBytes = 0;
+	std::vector<aiVector3D> bindVerts;
+	std::vector< std::vector<unsigned int> > levelIndices;
+	int levelVertices[MAX_LOD_LEVELS] = { 0 };
+	compactMeshes[index].resize(scene->mNumMeshes);
+	skinTables[index].resize(scene->mNumMeshes);
+	meshLevels[index].resize(scene->mNumMeshes);
+	skinBounds[index] = SkinBounds();
+	for (int m = 0; m < scene->mNumMeshes; m++)
+	{
+		mesh = scene->mMeshes[m];
+		importedBytes += importedMeshBytes(mesh) + 2 * mesh->mNumVertices * sizeof(aiVector3D); //and a float bind pose
+		buildSkinTable(mesh, &skinTables[index][m]);
+		buildMeshLevels(mesh, &skinTables[index][m], &meshLevels[index][m], &levelIndices);
+		buildCompactMesh(mesh, &compactMeshes[index][m]);
+		addLevelIndices(&compactMeshes[index][m], levelIndices, &meshLevels[index][m]);
+		for (int l = 0; l < MAX_LOD_LEVELS; l++)
+			levelVertices[l] += meshLevels[index][m][aisgl_min(l, (int)meshLevels[index][m].size() - 1)].numVertices;
+		decodePositions(&compactMeshes[index][m], &bindVerts);
+		addMeshBounds(&skinTables[index][m], bindVerts.data(), mesh->mNumBones, &skinBounds[index]);
+		releaseConvertedArrays(mesh);
+		compactBytes += importedMeshBytes(mesh) + compactMeshBytes(&compactMeshes[index][m]);
+	}
+	cout << "Mesh memory of " << fileName << ": " << importedBytes / 1024 << " KB before conversion, "
+		<< compactBytes / 1024 << " KB after" << endl;
+	cout << "Levels of detail of " << fileName << ": " << levelVertices[0];
+	for (int l = 1; l < MAX_LOD_LEVELS; l++) cout << " / " << levelVertices[l];
+	cout << " vertices" << endl;
+	meshStale[index].assign(scene->mNumMeshes, 0);
+	buildSkinChunks(scene, &skinChunks[index]);
+	
+    //~ printSceneInfo(scene);
+    //~ printMeshInfo(scene);
+    //~ if (index == 2)  printTreeInfo(scene->mRootNode);
+    //~ if (index == 2) printBoneInfo(scene);
+    //~ if (index == 2) printAnimInfo(scene);  //WARNING:  This may generate a lengthy output if the model has animation data
+    get_bounding_box(scene, &scene_min[index], &scene_max[index]);
+    scenes[index] = scene;
+    return true;
+}
+
+std::future<bool> loadCharacterAsync(int index)
+{
+    return std::async(std::launch::async, loadModel, modelFiles[index], companionFiles[index], index);
+}
+
+// Loads the three characters shown by the viewer in parallel
+void loadCharacters()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::future<bool> loads[3];
+    for (int i = 0; i < 3; i++) loads[i] = loadCharacterAsync(i);
+    bool loaded[3];
+    for (int i = 0; i < 3; i++) loaded[i] = loads[i].get();
+    for (int i = 0; i < 3; i++)
+    {
+		if (!loaded[i])
+		{
+			cout << "Couldn't load " << modelFiles[i] << endl;
+			exit(1);
+		}
+	}
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cout << "Characters loaded in " << ms << " ms (" << cachedScenes.size() << " of 5 files from the asset cache)" << endl;
+}
+
+// Bakes every loaded animation at bakeRate frames per tick, or maps the cache
+// file saved by a previous run ("<animation file>.bake") if it is still valid.
+void bakeAnimations()
+{
+	size_t total = 0;
+	for (int a = 0; a < 4; a++)
+	{
+		if (animations[a] == NULL || bvhStreams[a] != NULL) continue; //Streamed clips are never held whole
+		string path = string(animFiles[a]) + ".bake";
+		long long sourceTime = fileModTime(animFiles[a]);
+		bool mapped = mapBakedClip(path.c_str(), animations[a], bakeRate, sourceTime, &bakedClips[a]);
+		if (!mapped)
+		{
+			bakeClip(animations[a], bakeRate, a == 0, &bakedClips[a]);
+			if (!saveBakedClip(&bakedClips[a], animations[a], path.c_str(), sourceTime))
+				cout << "Couldn't write baked clip: " << path << endl;
+		}
+		total += bakedClipBytes(&bakedClips[a]);
+		cout << "Baked clip " << animFiles[a] << ": " << bakedClips[a].numFrames << " frames x "
+			<< bakedClips[a].numChannels << " channels = " << bakedClipBytes(&bakedClips[a]) / 1024.0 << " KB"
+			<< (mapped ? " (mapped from " + path + ")" : "") << endl;
+	}
+	cout << "Baked pose cache: " << total / 1024.0 << " KB" << endl;
+}
+
+// Compresses every loaded animation and releases its original keys, which are
+// not sampled any more. Clips must be baked (if at all) before this.
+void compressAnimations()
+{
+	size_t rawTotal = 0, total = 0;
+	for (int a = 0; a < 4; a++)
+	{
+		if (animations[a] == NULL || bvhStreams[a] != NULL) continue;
+		CompressedClip* clip = &compressedClips[a];
+		compressClip(animations[a], a == 0, clipPositionError, clipAngleError * AI_MATH_PI_F / 180, clip);
+		releaseClipKeys(animations[a]);
+		size_t bytes = compressedClipBytes(clip);
+		rawTotal += clip->rawBytes;
+		total += bytes;
+		cout << "Compressed clip " << animFiles[a] << ": " << clip->rawKeys << " -> " << clip->numKeys << " keys ("
+			<< clip->numConstant << " of " << clip->channels.size() << " channels constant), " << clip->rawBytes / 1024.0
+			<< " -> " << bytes / 1024.0 << " KB (" << (double)clip->rawBytes / aisgl_max(bytes, (size_t)1) << ":1), max error "
+			<< clip->maxPositionError << " units, " << clip->maxAngleError * 180 / AI_MATH_PI_F << " deg" << endl;
+	}
+	cout << "Compressed clips: " << rawTotal / 1024.0 << " -> " << total / 1024.0 << " KB" << endl;
+}
+
+// Local transform of a channel of animation n_animation: from its BVH stream
+// if it has one, otherwise from the baked cache when enabled, the compressed
+// clip or the keyframes
+aiMatrix4x4 sampleLocal(int n_animation, int channel, double tick)
+{
+	if (bvhStreams[n_animation] != NULL)
+		return sampleBVHStream(bvhStreams[n_animation], channel, tick);
+	if (useBakedPoses && bakedClips[n_animation].numFrames > 0)
+		return sampleBakedClip(&bakedClips[n_animation], channel, tick);
+	if (useCompressedClips)
+		return sampleCompressedChannel(&compressedClips[n_animation], channel, tick, &keyCursors[n_animation][channel]);
+	return sampleChannel(animations[n_animation]->mChannels[channel], tick,
+		&keyCursors[n_animation][channel], n_animation == 0);
+}
+
+// Channels of the scene's own clip that are not played (channel 23 of the
+// mannequin's run)
+bool channelSkipped(int scene, int channel)
+{
+	return scene == 1 && channel == 23;
+}
+
+// Time at which a clip is sampled: with the frame cache, the start of the
+// current frame (bakeRate frames per tick), otherwise the time itself
+double sampledTick(double tick)
+{
+	return useFrameCache ? floor(tick * bakeRate) / bakeRate : tick;
+}
+
+// Level of detail mesh m of a scene is used at for the given scene level
+const MeshLevel* sceneMeshLevel(int scene, int m, int level)
+{
+	const std::vector<MeshLevel>& levels = meshLevels[scene][m];
+	return &levels[aisgl_min(level, (int)levels.size() - 1)];
+}
+
+// Number of levels of the scene's most simplified mesh
+int numSceneLevels(int scene)
+{
+	int n = 1;
+	for (unsigned int m = 0; m < meshLevels[scene].size(); m++) n = aisgl_max(n, (int)meshLevels[scene][m].size());
+	return n;
+}
+
+// Update node vertices in character animation sequence
+
+void updateNodeMatrices(double tick, const aiScene* scene)
+{
+    PROFILE_SCOPE("updateNodeMatrices");
+    int n_animation = curr_scene;
+    aiAnimation* anim = animations[n_animation];
+    aiMatrix4x4 matProd, matRot;
+    int nd;
+    for (int i = 0; i < anim->mNumChannels; i++) {
+		if (channelSkipped(curr_scene, i)) continue;
+        matProd = sampleLocal(n_animation, i, tick);
+        
+        if (dwarf_2 && curr_scene == 2)
+        {
+			//Keep the dwarf in place and take the mapped joint rotations from the BVH walk
+			const RetargetMap* retarget = &retargets[curr_scene];
+			if (i == retarget->pinnedChannel)
+			{
+				aiVector3D posn = retarget->pinnedPosition;
+				matProd.a4 = posn.x; matProd.b4 = posn.y; matProd.c4 = posn.z;
+			}
+			if (retarget->sourceChannel[i] >= 0)
+			{
+				matRot = sampleLocal(3, retarget->sourceChannel[i], sampledTick(currTick[3]));
+				matProd.a1 = matRot.a1; matProd.a2 = matRot.a2; matProd.a3 = matRot.a3;
+				matProd.b1 = matRot.b1; matProd.b2 = matRot.b2; matProd.b3 = matRot.b3;
+				matProd.c1 = matRot.c1; matProd.c2 = matRot.c2; matProd.c3 = matRot.c3;
+			}
+		}
+        
+        nd = channelNodes[n_animation][i];
+        if (nd >= 0) skeletons[curr_scene].nodes[nd]->mTransformation = matProd;
+    }
+}
+
+// Global transforms and bone palettes of the current pose of the current scene
+void evaluateBonePalettes(const aiScene* scene)
+{
+	PROFILE_SCOPE("evaluateBonePalettes");
+	Skeleton* skel = &skeletons[curr_scene];
+	computeGlobalTransforms(skel);
+	updateBonePalettes(scene, skel);
+}
+
+// Skins the vertex chunks of the meshes in meshVisible with the current bone
+// palettes on the worker pool, which only reads the shared palettes. Meshes
+// left out are marked stale. Only the vertices of the scene's level of detail
+// are skinned.
+void skinPose(const aiScene* scene)
+{
+	PROFILE_SCOPE("skinPose");
+	Skeleton* skel = &skeletons[curr_scene];
+	int index = curr_scene;
+	int level = lodLevel[index];
+	const std::vector<char>& visible = meshVisible[index];
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+		meshStale[index][m] = !visible.empty() && !visible[m];
+	pool->run(skinChunks[index].size(), [&](int t) {
+		const SkinChunk& chunk = skinChunks[index][t];
+		if (meshStale[index][chunk.mesh]) return;
+		int end = aisgl_min(chunk.end, sceneMeshLevel(index, chunk.mesh, level)->numVertices);
+		if (end <= chunk.begin) return;
+		PROFILE_COUNT(PROFILE_VERTICES, end - chunk.begin);
+		aiMesh* mesh = scene->mMeshes[chunk.mesh];
+		skinVertices(skinKernel, &skinTables[index][chunk.mesh], skel->palette[chunk.mesh].data(),
+			&compactMeshes[index][chunk.mesh], mesh->mVertices, mesh->mNormals, chunk.begin, end);
+	});
+	skinnedLevel[index] = level;
+}
+
+// Transform vertices of character models. The pose is evaluated once, then
+// skinned by skinPose().
+void transformVertices(const aiScene* scene)
+{
+	PROFILE_SCOPE("transformVertices");
+	evaluateBonePalettes(scene);
+	skinPose(scene);
+}
+
+// True if a mesh in meshVisible was left out of the last skinning pass
+bool visibleMeshStale(int index)
+{
+	for (unsigned int m = 0; m < meshStale[index].size(); m++)
+		if (meshStale[index][m] && (meshVisible[index].empty() || meshVisible[index][m])) return true;
+	return false;
+}
+
+// True if the scene is to be drawn at a finer level than it was skinned at
+bool levelStale(int index)
+{
+	return lodLevel[index] < skinnedLevel[index];
+}
+
+// skinPose() for the pose of the given ticks (palettes already evaluated),
+// from the frame cache when it holds the pose's frame. Frames with meshes
+// left out are not cached.
+void skinPoseCached(const aiScene* scene, double tick, double sourceTick)
+{
+	FrameKey key;
+	key.frame = (long)floor(tick * bakeRate + 0.5);
+	key.sourceFrame = sourceTick < 0 ? -1 : (long)floor(sourceTick * bakeRate + 0.5);
+	key.baked = useBakedPoses;
+	key.level = lodLevel[curr_scene];
+	if (useFrameCache && fetchSkinnedFrame(curr_scene, scene, key))
+	{
+		meshStale[curr_scene].assign(scene->mNumMeshes, 0);
+		skinnedLevel[curr_scene] = key.level;
+		return;
+	}
+	skinPose(scene);
+	const std::vector<char>& stale = meshStale[curr_scene];
+	if (useFrameCache && std::find(stale.begin(), stale.end(), 1) == stale.end())
+		storeSkinnedFrame(curr_scene, scene, key);
+}
+
+// Compares every SIMD skinning kernel supported by this CPU against the scalar
+// kernel for all scenes at a few animation ticks. Returns false if any vertex
+// differs by more than a small fraction of the model's size.
+bool verifySkinning()
+{
+	const int numTicks = 3;
+	bool passed = true;
+	int saved_scene = curr_scene;
+	for (curr_scene = 0; curr_scene < 3; curr_scene++)
+	{
+		const aiScene* scene = scenes[curr_scene];
+		Skeleton* skel = &skeletons[curr_scene];
+		aiVector3D extent = scene_max[curr_scene] - scene_min[curr_scene];
+		float size = aisgl_max(extent.x, aisgl_max(extent.y, extent.z));
+		float maxErr[NUM_SKIN_KERNELS] = { 0 };
+		for (int t = 0; t < numTicks; t++)
+		{
+			updateNodeMatrices(tDuration[curr_scene] * t / numTicks, scene);
+			evaluateBonePalettes(scene);
+			for (unsigned int n = 0; n < scene->mNumMeshes; n++)
+			{
+				const CompactMesh* bind = &compactMeshes[curr_scene][n];
+				int numVert = bind->numVertices;
+				std::vector<aiVector3D> refVerts(numVert), refNorms(numVert), verts(numVert), norms(numVert);
+				skinVertices(SKIN_SCALAR, &skinTables[curr_scene][n], skel->palette[n].data(),
+					bind, refVerts.data(), refNorms.data(), 0, numVert);
+				for (int k = SKIN_SCALAR + 1; k < NUM_SKIN_KERNELS; k++)
+				{
+					if (!skinningKernelSupported((SkinningKernel)k)) continue;
+					skinVertices((SkinningKernel)k, &skinTables[curr_scene][n], skel->palette[n].data(),
+						bind, verts.data(), norms.data(), 0, numVert);
+					for (int i = 0; i < numVert; i++)
+					{
+						maxErr[k] = aisgl_max(maxErr[k], (verts[i] - refVerts[i]).Length() / size);
+						maxErr[k] = aisgl_max(maxErr[k], (norms[i] - refNorms[i]).Length() / aisgl_max(refNorms[i].Length(), 1e-6f));
+					}
+				}
+			}
+		}
+		for (int k = SKIN_SCALAR + 1; k < NUM_SKIN_KERNELS; k++)
+		{
+			if (!skinningKernelSupported((SkinningKernel)k)) continue;
+			bool ok = maxErr[k] < 1e-5;
+			cout << "Scene " << curr_scene << ": " << skinningKernelNames[k] << " vs scalar, max relative error = "
+				<< maxErr[k] << (ok ? "  PASS" : "  FAIL") << endl;
+			passed = passed && ok;
+		}
+	}
+	curr_scene = saved_scene;
+	return passed;
+}
+
+// Playback rate of animation a
+double ticksPerSecond(int a)
+{
+	if (nativeTickRate && animations[a]->mTicksPerSecond > 0) return animations[a]->mTicksPerSecond;
+	return 1000.0 / timeStep;
+}
+
+// Moves the animation of the current scene (and, for dwarf_2, the BVH walk)
+// on by the given number of ticks, wrapping around at the end of the clip
+void advanceTicks(double ticks = 1)
+{
+    currTick[curr_scene] = fmod(currTick[curr_scene] + ticks, aisgl_max(tDuration[curr_scene], 1));
+    if (dwarf_2 && curr_scene == 2)
+		currTick[3] = fmod(currTick[3] + ticks * ticksPerSecond(3) / ticksPerSecond(2), aisgl_max(tDuration[3], 1));
+}
+
+// Moves the animations on by elapsed wall-clock time
+void advanceClock(double seconds)
+{
+    advanceTicks(seconds * ticksPerSecond(curr_scene));
+}
+
+// What a pose was evaluated for: the pose (and skinning) of a scene is only
+// recomputed when one of these changes
+struct PoseKey
+{
+	double tick, sourceTick; //sourceTick: the retargeted clip's, -1 when not playing
+	bool baked;
+
+	bool operator==(const PoseKey& k) const
+	{
+		return tick == k.tick && sourceTick == k.sourceTick && baked == k.baked;
+	}
+};
+
+PoseKey currentPoseKey()
+{
+	PoseKey key;
+	key.tick = sampledTick(currTick[curr_scene]);
+	key.sourceTick = (dwarf_2 && curr_scene == 2) ? sampledTick(currTick[3]) : -1;
+	key.baked = useBakedPoses;
+	return key;
+}
+
+// Handles the command line options shared by all programs using this file:
+// --skinning=<kernel>, --threads=<n>, --bake[=<frames per tick>], --native-rate,
+// --frame-cache[=<MB>], --compress-clips[=<position error>,<angle error in degrees>]
+// and --stream-bvh[=<window frames>].
+// Returns false if the option is not one of them.
+bool parseCharacterOption(const char* arg)
+{
+	if (strncmp(arg, "--skinning=", 11) == 0)
+	{
+		SkinningKernel k = skinningKernelFromName(arg + 11);
+		if (k == NUM_SKIN_KERNELS || !skinningKernelSupported(k))
+			cout << "Skinning kernel " << arg + 11 << " is not available" << endl;
+		else skinKernel = k;
+	}
+	else if (strcmp(arg, "--no-asset-cache") == 0) useAssetCache = false;
+	else if (strcmp(arg, "--native-rate") == 0) nativeTickRate = true;
+	else if (strncmp(arg, "--frame-cache", 13) == 0)
+	{
+		useFrameCache = true;
+		if (arg[13] == '=') frameCacheBudget = (size_t)(atof(arg + 14) * 1048576);
+	}
+	else if (strncmp(arg, "--compress-clips", 16) == 0)
+	{
+		useCompressedClips = true;
+		if (arg[16] == '=') sscanf(arg + 17, "%f,%f", &clipPositionError, &clipAngleError);
+	}
+	else if (strncmp(arg, "--stream-bvh", 12) == 0)
+	{
+		streamBVH = true;
+		if (arg[12] == '=') bvhWindowFrames = aisgl_max(atoi(arg + 13), 2);
+	}
+	else if (strncmp(arg, "--threads=", 10) == 0) numThreads = atoi(arg + 10);
+	else if (strncmp(arg, "--bake", 6) == 0)
+	{
+		useBakedPoses = true;
+		if (arg[6] == '=') bakeRate = atof(arg + 7);
+		if (bakeRate <= 0) bakeRate = 1;
+	}
+	else return false;
+	return true;
+}
+
+// Creates the skinning worker pool
+void startWorkers()
+{
+	if (numThreads < 1) numThreads = std::thread::hardware_concurrency();
+	if (numThreads < 1) numThreads = 1;
+	pool = new ThreadPool(numThreads);
+	cout << "Skinning kernel: " << skinningKernelNames[skinKernel] << ", threads: " << numThreads << endl;
+}
@@ -0,0 +1,392 @@
+// ----------------------------------------------------------------------------
+// Animation clip compression
+//
+// Removes keys that can be rebuilt from their neighbours within an error
+// bound, quantizes rotations and drops the keys of constant channels:
+//  - Position and scaling keys are stepped by sampleChannel() (the first key
+//    at or after the tick is used), so a key is dropped when its value is
+//    within the bound of the next kept key.
+//  - Slerped rotation keys are dropped when the slerp between the kept keys
+//    around them reproduces them, and the curve halfway between them, within
+//    the angular bound.
+//  - Rotations are stored as the three smallest quaternion components (15
+//    bits each) plus the index of the largest: 48 bits per key. Key times
+//    are floats.
+//  - A channel left with a single key per track becomes one constant matrix.
+//  - An empty track stays empty and samples as the identity.
+// sampleCompressedChannel() follows sampleChannel() key for key, using the
+// same cursors.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cmath>
+
+#define CLIP_SCALE_ERROR 1e-4f //Bound on scaling factors
+
+struct TimeKey
+{
+	float mTime; //Named like the assimp keys so that findKey() works on it
+};
+
+struct CompressedTrack
+{
+	unsigned int time;    //Index of the first key time in the clip's times
+	unsigned int value;   //and of its value in vectors (rotations / 3 for rotation tracks)
+	unsigned int numKeys; //0 for a channel without scaling keys
+};
+
+struct CompressedChannel
+{
+	CompressedTrack position, rotation, scaling;
+	bool stepRotation; //Rotations are stepped like positions
+	int constant;      //Index of the matrix of a constant channel, or -1
+};
+
+struct CompressedClip
+{
+	std::vector<CompressedChannel> channels;
+	std::vector<TimeKey> times;
+	std::vector<aiVector3D> vectors;       //Position and scaling values
+	std::vector<unsigned short> rotations; //Smallest-three rotations, 3 per key
+	std::vector<aiMatrix4x4> constants;
+	size_t rawBytes;
+	int rawKeys, numKeys, numConstant;
+	float maxPositionError, maxAngleError; //Measured after compression (angle in radians)
+
+	CompressedClip() : rawBytes(0), rawKeys(0), numKeys(0), numConstant(0), maxPositionError(0), maxAngleError(0) {}
+};
+
+// ----------------------------------------------------------------------------
+void encodeRotation(aiQuaternion q, unsigned short* out)
+{
+	q.Normalize();
+	float c[4] = { q.x, q.y, q.z, q.w };
+	int largest = 0;
+	for (int k = 1; k < 4; k++)
+		if (fabs(c[k]) > fabs(c[largest])) largest = k;
+	float sign = c[largest] < 0 ? -1.0f : 1.0f; //q and -q are the same rotation
+	unsigned long long bits = largest;
+	for (int k = 0, j = 0; k < 4; k++)
+	{
+		if (k == largest) continue;
+		float v = c[k] * sign * (float)M_SQRT2; //[-1, 1]
+		long q15 = lrintf((v * 0.5f + 0.5f) * 32767);
+		bits |= (unsigned long long)aisgl_max(0L, aisgl_min(q15, 32767L)) << (2 + 15 * j++);
+	}
+	out[0] = bits & 0xffff;
+	out[1] = (bits >> 16) & 0xffff;
+	out[2] = (bits >> 32) & 0xffff;
+}
+
+inline aiQuaternion decodeRotation(const unsigned short* in)
+{
+	unsigned long long bits = in[0] | ((unsigned long long)in[1] << 16) | ((unsigned long long)in[2] << 32);
+	int largest = bits & 3;
+	float c[4], sum = 0;
+	for (int k = 0, j = 0; k < 4; k++)
+	{
+		if (k == largest) continue;
+		c[k] = (((bits >> (2 + 15 * j++)) & 0x7fff) * (2 / 32767.0f) - 1) * (float)M_SQRT1_2;
+		sum += c[k] * c[k];
+	}
+	c[largest] = sqrt(aisgl_max(1 - sum, 0.0f));
+	return aiQuaternion(c[3], c[0], c[1], c[2]);
+}
+
+float rotationAngle(const aiQuaternion& a, const aiQuaternion& b)
+{
+	float d = fabs(a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z);
+	return 2 * acos(aisgl_min(d, 1.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Keys of a stepped track to keep: a key is dropped if the next kept key is
+// within maxError of it (the last key is always kept). Empty for no keys.
+std::vector<unsigned int> reduceSteppedKeys(const std::vector<aiVector3D>& values, float maxError)
+{
+	std::vector<unsigned int> keep;
+	int n = values.size();
+	if (n == 0) return keep;
+	int next = n - 1;
+	keep.push_back(next);
+	for (int k = n - 2; k >= 0; k--)
+	{
+		if ((values[k] - values[next]).Length() <= maxError) continue;
+		keep.push_back(k);
+		next = k;
+	}
+	std::reverse(keep.begin(), keep.end());
+	return keep;
+}
+
+std::vector<unsigned int> reduceSteppedRotations(const std::vector<aiQuaternion>& values, float maxAngle)
+{
+	std::vector<unsigned int> keep;
+	int n = values.size();
+	if (n == 0) return keep;
+	int next = n - 1;
+	keep.push_back(next);
+	for (int k = n - 2; k >= 0; k--)
+	{
+		if (rotationAngle(values[k], values[next]) <= maxAngle) continue;
+		keep.push_back(k);
+		next = k;
+	}
+	std::reverse(keep.begin(), keep.end());
+	return keep;
+}
+
+// Angle between the slerp from key a to key b at time t and the rotation q
+float slerpError(const std::vector<float>& times, const std::vector<aiQuaternion>& values, int a, int b, float t,
+	const aiQuaternion& q)
+{
+	float factor = (times[b] == times[a]) ? 1.0f : (t - times[a]) / (times[b] - times[a]);
+	aiQuaternion s;
+	aiQuaternion::Interpolate(s, values[a], values[b], factor);
+	return rotationAngle(s, q);
+}
+
+// Keys of a slerped track to keep: every segment between kept keys is made
+// as long as the slerp across it stays within maxAngle of the keys it skips
+// and of the original curve halfway between each pair of skipped keys.
+// The first and last keys are kept (they are slerped across the loop), unless
+// every key is within maxAngle of the first.
+std::vector<unsigned int> reduceSlerpedRotations(const std::vector<float>& times, const std::vector<aiQuaternion>& values,
+	float maxAngle)
+{
+	std::vector<unsigned int> keep;
+	int n = values.size();
+	if (n == 0) return keep;
+	keep.push_back(0);
+	int k = 1;
+	while (k < n && rotationAngle(values[0], values[k]) <= maxAngle) k++;
+	if (k == n) return keep;
+	int a = 0;
+	while (a < n - 1)
+	{
+		int b = a + 1;
+		while (b + 1 < n)
+		{
+			bool fits = true;
+			for (int k = a + 1; k <= b + 1 && fits; k++)
+			{
+				aiQuaternion mid;
+				aiQuaternion::Interpolate(mid, values[k - 1], values[k], 0.5f);
+				fits = slerpError(times, values, a, b + 1, (times[k - 1] + times[k]) / 2, mid) <= maxAngle
+					&& (k > b || slerpError(times, values, a, b + 1, times[k], values[k]) <= maxAngle);
+			}
+			if (!fits) break;
+			b++;
+		}
+		keep.push_back(b);
+		a = b;
+	}
+	return keep;
+}
+
+// ----------------------------------------------------------------------------
+// Local transform of channel c at the given tick, as sampleChannel() computes
+// it from the original keys
+aiMatrix4x4 sampleCompressedChannel(const CompressedClip* clip, int c, double tick, KeyCursor* cursor)
+{
+	const CompressedChannel* ch = &clip->channels[c];
+	if (ch->constant >= 0) return clip->constants[ch->constant];
+	aiMatrix4x4 matPos, matScl;
+
+	const CompressedTrack* track = &ch->position;
+	unsigned int index;
+	if (track->numKeys > 0)
+	{
+		index = findKey(&clip->times[track->time], track->numKeys, tick, &cursor->position);
+		aiMatrix4x4::Translation(clip->vectors[track->value + index], matPos);
+	}
+
+	track = &ch->scaling;
+	if (track->numKeys > 0)
+	{
+		index = findKey(&clip->times[track->time], track->numKeys, tick, &cursor->scaling);
+		aiMatrix4x4::Scaling(clip->vectors[track->value + index], matScl);
+	}
+
+	track = &ch->rotation;
+	const unsigned short* rotations = clip->rotations.data() + track->value * 3;
+	aiQuaternion rotn; //Identity for an empty track
+	if (track->numKeys == 1)
+		rotn = decodeRotation(rotations);
+	else if (track->numKeys > 1)
+	{
+		const TimeKey* times = &clip->times[track->time];
+		index = findKey(times, track->numKeys, tick, &cursor->rotation);
+		rotn = decodeRotation(rotations + index * 3);
+		if (!ch->stepRotation)
+		{
+			unsigned int prev = (index == 0) ? track->numKeys - 1 : index - 1;
+			float time1 = times[prev].mTime, time2 = times[index].mTime;
+			float factor = (time2 == time1) ? 1.0f : (tick - time1) / (time2 - time1);
+			factor = aisgl_max(0.0f, aisgl_min(factor, 1.0f));
+			aiQuaternion q;
+			aiQuaternion::Interpolate(q, decodeRotation(rotations + prev * 3), rotn, factor);
+			rotn = q;
+		}
+	}
+	return matPos * aiMatrix4x4(rotn.GetMatrix()) * matScl;
+}
+
+// ----------------------------------------------------------------------------
+// Appends the kept keys of a position or scaling track to the clip
+CompressedTrack addTrack(CompressedClip* clip, const std::vector<float>& times, const std::vector<aiVector3D>& values,
+	const std::vector<unsigned int>& keep)
+{
+	CompressedTrack track = { (unsigned int)clip->times.size(), (unsigned int)clip->vectors.size(), (unsigned int)keep.size() };
+	for (unsigned int k = 0; k < keep.size(); k++)
+	{
+		TimeKey t = { times[keep[k]] };
+		clip->times.push_back(t);
+		clip->vectors.push_back(values[keep[k]]);
+	}
+	return track;
+}
+
+// ----------------------------------------------------------------------------
+// Largest translation (model units) and rotation (radians) difference between
+// the original and compressed clip, at every original key time and halfway
+// between rotation keys
+void measureClipError(const aiAnimation* anim, bool stepRotation, CompressedClip* clip)
+{
+	clip->maxPositionError = clip->maxAngleError = 0;
+	for (unsigned int c = 0; c < anim->mNumChannels; c++)
+	{
+		const aiNodeAnim* ch = anim->mChannels[c];
+		if (ch->mNumPositionKeys == 0 || ch->mNumRotationKeys == 0) continue; //sampleChannel() needs both tracks
+		std::vector<double> ticks;
+		for (unsigned int k = 0; k < ch->mNumPositionKeys; k++) ticks.push_back(ch->mPositionKeys[k].mTime);
+		for (unsigned int k = 0; k < ch->mNumScalingKeys; k++) ticks.push_back(ch->mScalingKeys[k].mTime);
+		for (unsigned int k = 0; k < ch->mNumRotationKeys; k++)
+		{
+			ticks.push_back(ch->mRotationKeys[k].mTime);
+			if (k > 0) ticks.push_back((ch->mRotationKeys[k - 1].mTime + ch->mRotationKeys[k].mTime) / 2);
+		}
+		std::sort(ticks.begin(), ticks.end());
+		KeyCursor rawCursor = { 0, 0, 0 }, cursor = { 0, 0, 0 };
+		for (unsigned int t = 0; t < ticks.size(); t++)
+		{
+			aiMatrix4x4 a = sampleChannel(ch, ticks[t], &rawCursor, stepRotation);
+			aiMatrix4x4 b = sampleCompressedChannel(clip, c, ticks[t], &cursor);
+			aiVector3D da(a.a4 - b.a4, a.b4 - b.b4, a.c4 - b.c4);
+			clip->maxPositionError = aisgl_max(clip->maxPositionError, da.Length());
+
+			//Angle of the relative rotation, from the trace of A^T B (columns normalized)
+			float trace = 0;
+			for (int col = 0; col < 3; col++)
+			{
+				aiVector3D ca(a[0][col], a[1][col], a[2][col]), cb(b[0][col], b[1][col], b[2][col]);
+				float la = ca.Length(), lb = cb.Length();
+				if (la > 0 && lb > 0) trace += (ca * cb) / (la * lb);
+			}
+			float cosAngle = aisgl_max(-1.0f, aisgl_min((trace - 1) / 2, 1.0f));
+			clip->maxAngleError = aisgl_max(clip->maxAngleError, (float)acos(cosAngle));
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Compresses a clip with the given bounds on position (model units) and
+// rotation (radians) error. stepRotation has the meaning of sampleChannel():
+// rotations are taken at the position keys instead of slerped.
+void compressClip(const aiAnimation* anim, bool stepRotation, float maxPosition, float maxAngle, CompressedClip* clip)
+{
+	*clip = CompressedClip();
+	clip->channels.resize(anim->mNumChannels);
+	for (unsigned int c = 0; c < anim->mNumChannels; c++)
+	{
+		const aiNodeAnim* ch = anim->mChannels[c];
+		CompressedChannel* out = &clip->channels[c];
+		clip->rawKeys += ch->mNumPositionKeys + ch->mNumRotationKeys + ch->mNumScalingKeys;
+		clip->rawBytes += (ch->mNumPositionKeys + ch->mNumScalingKeys) * sizeof(aiVectorKey)
+			+ ch->mNumRotationKeys * sizeof(aiQuatKey);
+
+		std::vector<float> times;
+		std::vector<aiVector3D> values;
+		for (unsigned int k = 0; k < ch->mNumPositionKeys; k++)
+		{
+			times.push_back(ch->mPositionKeys[k].mTime);
+			values.push_back(ch->mPositionKeys[k].mValue);
+		}
+		out->position = addTrack(clip, times, values, reduceSteppedKeys(values, maxPosition));
+
+		times.clear();
+		values.clear();
+		for (unsigned int k = 0; k < ch->mNumScalingKeys; k++)
+		{
+			times.push_back(ch->mScalingKeys[k].mTime);
+			values.push_back(ch->mScalingKeys[k].mValue);
+		}
+		out->scaling = addTrack(clip, times, values, reduceSteppedKeys(values, CLIP_SCALE_ERROR));
+
+		//Rotations are quantized first, so that the reduction sees the decoded values
+		times.clear();
+		std::vector<aiQuaternion> rotations;
+		std::vector<unsigned short> encoded(3);
+		out->stepRotation = stepRotation && ch->mNumRotationKeys > 1;
+		unsigned int numRotations = out->stepRotation ? ch->mNumPositionKeys : ch->mNumRotationKeys;
+		for (unsigned int k = 0; k < numRotations; k++)
+		{
+			const aiQuatKey* key = &ch->mRotationKeys[aisgl_min(k, ch->mNumRotationKeys - 1)];
+			times.push_back(out->stepRotation ? ch->mPositionKeys[k].mTime : key->mTime);
+			encodeRotation(key->mValue, encoded.data());
+			rotations.push_back(decodeRotation(encoded.data()));
+		}
+		std::vector<unsigned int> keep = out->stepRotation ? reduceSteppedRotations(rotations, maxAngle)
+			: reduceSlerpedRotations(times, rotations, maxAngle);
+		out->rotation.time = clip->times.size();
+		out->rotation.value = clip->rotations.size() / 3;
+		out->rotation.numKeys = keep.size();
+		for (unsigned int k = 0; k < keep.size(); k++)
+		{
+			TimeKey t = { times[keep[k]] };
+			clip->times.push_back(t);
+			const aiQuatKey* key = &ch->mRotationKeys[aisgl_min(keep[k], ch->mNumRotationKeys - 1)];
+			encodeRotation(key->mValue, encoded.data());
+			clip->rotations.insert(clip->rotations.end(), encoded.begin(), encoded.end());
+		}
+
+		//A channel with one key per track is replaced by its matrix
+		out->constant = -1;
+		if (out->position.numKeys == 1 && out->rotation.numKeys == 1 && out->scaling.numKeys <= 1)
+		{
+			KeyCursor cursor = { 0, 0, 0 };
+			clip->constants.push_back(sampleCompressedChannel(clip, c, 0, &cursor));
+			out->constant = clip->constants.size() - 1;
+			clip->times.resize(out->position.time);
+			clip->vectors.resize(out->position.value);
+			clip->rotations.resize(out->rotation.value * 3);
+			out->position.numKeys = out->rotation.numKeys = out->scaling.numKeys = 0;
+			clip->numConstant++;
+		}
+		clip->numKeys += out->position.numKeys + out->rotation.numKeys + out->scaling.numKeys;
+	}
+	measureClipError(anim, stepRotation, clip);
+}
+
+// ----------------------------------------------------------------------------
+size_t compressedClipBytes(const CompressedClip* clip)
+{
+	return clip->channels.size() * sizeof(CompressedChannel) + clip->times.size() * sizeof(TimeKey)
+		+ clip->vectors.size() * sizeof(aiVector3D) + clip->rotations.size() * sizeof(unsigned short)
+		+ clip->constants.size() * sizeof(aiMatrix4x4);
+}
+
+// ----------------------------------------------------------------------------
+// Frees the original keys of an animation once it is sampled from its
+// compressed clip only
+void releaseClipKeys(aiAnimation* anim)
+{
+	for (unsigned int c = 0; c < anim->mNumChannels; c++)
+	{
+		aiNodeAnim* ch = anim->mChannels[c];
+		releaseSceneArray(ch->mPositionKeys, ch->mNumPositionKeys);
+		releaseSceneArray(ch->mRotationKeys, ch->mNumRotationKeys);
+		releaseSceneArray(ch->mScalingKeys, ch->mNumScalingKeys);
+		ch->mNumPositionKeys = ch->mNumRotationKeys = ch->mNumScalingKeys = 0;
+	}
+}
@@ -0,0 +1,241 @@
+// ----------------------------------------------------------------------------
+// Compact bind-pose meshes
+//
+// At load time the bind pose of every mesh is converted into a quantized
+// form: positions as 16-bit integers over the mesh's bounding box, normals
+// octahedral-encoded into two 16-bit values, texture coordinates as 16-bit
+// integers over their range, and 16-bit indices when the mesh has at most
+// 65536 vertices. That is 12 bytes per vertex for the skinning input instead
+// of 24. The skinning kernels decode it while they skin, and the arrays of
+// the imported mesh that are no longer needed are released; the imported
+// positions and normals stay as the skinning output.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cmath>
+
+struct CompactMesh
+{
+	int numVertices;
+	aiVector3D posMin, posStep;            //Position = posMin + q * posStep (per axis)
+	std::vector<unsigned short> positions; //4 per vertex: x, y, z and a pad for aligned loads
+	std::vector<short> normals;            //2 per vertex, octahedral (-32767..32767)
+	float uvMin[2], uvStep[2];
+	std::vector<unsigned short> texCoords; //2 per vertex, empty without texture coordinates
+	int primitiveSize;                     //Indices per primitive: 1 (points), 2 (lines) or 3
+	std::vector<unsigned short> indices16; //Used if numVertices <= 65536
+	std::vector<unsigned int> indices32;   //otherwise
+
+	bool hasTexCoords() const { return !texCoords.empty(); }
+	int numIndices() const { return indices16.empty() ? indices32.size() : indices16.size(); }
+};
+
+// ----------------------------------------------------------------------------
+// Octahedral encoding: the unit sphere is projected onto the octahedron
+// |x|+|y|+|z| = 1 and the lower half folded over the diagonals
+void octEncode(const aiVector3D& n, short* out)
+{
+	float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	if (l1 == 0)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+	float u = n.x / l1, v = n.y / l1;
+	if (n.z < 0)
+	{
+		float fu = (1 - fabs(v)) * (u >= 0 ? 1 : -1);
+		float fv = (1 - fabs(u)) * (v >= 0 ? 1 : -1);
+		u = fu; v = fv;
+	}
+	out[0] = (short)lrintf(aisgl_min(aisgl_max(u, -1.0f), 1.0f) * 32767);
+	out[1] = (short)lrintf(aisgl_min(aisgl_max(v, -1.0f), 1.0f) * 32767);
+}
+
+// The decoded normal is not unit length; GL_NORMALIZE and the skinning shader
+// normalize after the bone transform anyway.
+inline aiVector3D octDecode(const short* in)
+{
+	aiVector3D n(in[0] * (1 / 32767.0f), in[1] * (1 / 32767.0f), 0);
+	n.z = 1 - fabs(n.x) - fabs(n.y);
+	float t = aisgl_max(-n.z, 0.0f);
+	n.x += n.x >= 0 ? -t : t;
+	n.y += n.y >= 0 ? -t : t;
+	return n;
+}
+
+inline aiVector3D decodePosition(const CompactMesh* cm, int i)
+{
+	const unsigned short* q = &cm->positions[i * 4];
+	return aiVector3D(cm->posMin.x + q[0] * cm->posStep.x, cm->posMin.y + q[1] * cm->posStep.y,
+		cm->posMin.z + q[2] * cm->posStep.z);
+}
+
+inline aiVector3D decodeNormal(const CompactMesh* cm, int i)
+{
+	return octDecode(&cm->normals[i * 2]);
+}
+
+// ----------------------------------------------------------------------------
+// Quantizes values to 16 bits over [min, max]: value = min + q * step
+unsigned short quantize16(float value, float min, float step)
+{
+	return step > 0 ? (unsigned short)lrintf(aisgl_min((value - min) / step, 65535.0f)) : 0;
+}
+
+// ----------------------------------------------------------------------------
+// Polygons are split into triangle fans; points and lines are kept as they are.
+void buildCompactIndices(const aiMesh* mesh, CompactMesh* cm)
+{
+	cm->primitiveSize = 3;
+	if (mesh->mNumFaces > 0 && mesh->mFaces[0].mNumIndices <= 2) cm->primitiveSize = mesh->mFaces[0].mNumIndices;
+
+	std::vector<unsigned int> indices;
+	for (unsigned int k = 0; k < mesh->mNumFaces; k++)
+	{
+		const aiFace* face = &mesh->mFaces[k];
+		if (cm->primitiveSize != 3)
+		{
+			if (face->mNumIndices == (unsigned int)cm->primitiveSize)
+				indices.insert(indices.end(), face->mIndices, face->mIndices + face->mNumIndices);
+			continue;
+		}
+		for (unsigned int i = 2; i < face->mNumIndices; i++)
+		{
+			indices.push_back(face->mIndices[0]);
+			indices.push_back(face->mIndices[i - 1]);
+			indices.push_back(face->mIndices[i]);
+		}
+	}
+	cm->indices16.clear();
+	cm->indices32.clear();
+	if (mesh->mNumVertices <= 65536) cm->indices16.assign(indices.begin(), indices.end());
+	else cm->indices32.swap(indices);
+}
+
+// ----------------------------------------------------------------------------
+void buildCompactMesh(const aiMesh* mesh, CompactMesh* cm)
+{
+	int numVert = mesh->mNumVertices;
+	cm->numVertices = numVert;
+
+	aiVector3D min(1e10f, 1e10f, 1e10f), max(-1e10f, -1e10f, -1e10f);
+	for (int i = 0; i < numVert; i++)
+	{
+		const aiVector3D& p = mesh->mVertices[i];
+		min.x = aisgl_min(min.x, p.x); max.x = aisgl_max(max.x, p.x);
+		min.y = aisgl_min(min.y, p.y); max.y = aisgl_max(max.y, p.y);
+		min.z = aisgl_min(min.z, p.z); max.z = aisgl_max(max.z, p.z);
+	}
+	cm->posMin = numVert > 0 ? min : aiVector3D();
+	cm->posStep = numVert > 0 ? (max - min) / 65535.0f : aiVector3D();
+	cm->positions.resize(numVert * 4);
+	cm->normals.resize(numVert * 2);
+	for (int i = 0; i < numVert; i++)
+	{
+		const aiVector3D& p = mesh->mVertices[i];
+		unsigned short* q = &cm->positions[i * 4];
+		q[0] = quantize16(p.x, cm->posMin.x, cm->posStep.x);
+		q[1] = quantize16(p.y, cm->posMin.y, cm->posStep.y);
+		q[2] = quantize16(p.z, cm->posMin.z, cm->posStep.z);
+		q[3] = 0;
+		octEncode(mesh->HasNormals() ? mesh->mNormals[i] : aiVector3D(0, 0, 1), &cm->normals[i * 2]);
+	}
+
+	cm->texCoords.clear();
+	cm->uvMin[0] = cm->uvMin[1] = cm->uvStep[0] = cm->uvStep[1] = 0;
+	if (mesh->HasTextureCoords(0) && numVert > 0)
+	{
+		const aiVector3D* uv = mesh->mTextureCoords[0];
+		for (int c = 0; c < 2; c++)
+		{
+			float lo = uv[0][c], hi = uv[0][c];
+			for (int i = 1; i < numVert; i++)
+			{
+				lo = aisgl_min(lo, uv[i][c]);
+				hi = aisgl_max(hi, uv[i][c]);
+			}
+			cm->uvMin[c] = lo;
+			cm->uvStep[c] = (hi - lo) / 65535.0f;
+		}
+		cm->texCoords.resize(numVert * 2);
+		for (int i = 0; i < numVert; i++)
+			for (int c = 0; c < 2; c++)
+				cm->texCoords[i * 2 + c] = quantize16(uv[i][c], cm->uvMin[c], cm->uvStep[c]);
+	}
+	buildCompactIndices(mesh, cm);
+}
+
+// ----------------------------------------------------------------------------
+// Bind pose positions, normals or texture coordinates expanded to floats (for
+// uploads and load-time tables)
+void decodePositions(const CompactMesh* cm, std::vector<aiVector3D>* out)
+{
+	out->resize(cm->numVertices);
+	for (int i = 0; i < cm->numVertices; i++) (*out)[i] = decodePosition(cm, i);
+}
+
+void decodeNormals(const CompactMesh* cm, std::vector<aiVector3D>* out)
+{
+	out->resize(cm->numVertices);
+	for (int i = 0; i < cm->numVertices; i++) (*out)[i] = decodeNormal(cm, i);
+}
+
+void decodeTexCoords(const CompactMesh* cm, std::vector<float>* out)
+{
+	out->resize(cm->texCoords.size());
+	for (unsigned int k = 0; k < cm->texCoords.size(); k++)
+		(*out)[k] = cm->uvMin[k % 2] + cm->texCoords[k] * cm->uvStep[k % 2];
+}
+
+// ----------------------------------------------------------------------------
+size_t compactMeshBytes(const CompactMesh* cm)
+{
+	return cm->positions.size() * sizeof(unsigned short) + cm->normals.size() * sizeof(short)
+		+ cm->texCoords.size() * sizeof(unsigned short) + cm->indices16.size() * sizeof(unsigned short)
+		+ cm->indices32.size() * sizeof(unsigned int);
+}
+
+// Bytes held by the vertex streams, faces and bone weights of an imported mesh
+size_t importedMeshBytes(const aiMesh* mesh)
+{
+	size_t bytes = 0;
+	if (mesh->mVertices != NULL) bytes += mesh->mNumVertices * sizeof(aiVector3D);
+	if (mesh->mNormals != NULL) bytes += mesh->mNumVertices * sizeof(aiVector3D);
+	for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++)
+		if (mesh->mTextureCoords[k] != NULL) bytes += mesh->mNumVertices * sizeof(aiVector3D);
+	for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++)
+		if (mesh->mColors[k] != NULL) bytes += mesh->mNumVertices * sizeof(aiColor4D);
+	if (mesh->mFaces != NULL) bytes += mesh->mNumFaces * sizeof(aiFace);
+	for (unsigned int f = 0; f < mesh->mNumFaces; f++) bytes += mesh->mFaces[f].mNumIndices * sizeof(unsigned int);
+	for (unsigned int b = 0; b < mesh->mNumBones; b++) bytes += mesh->mBones[b]->mNumWeights * sizeof(aiVertexWeight);
+	return bytes;
+}
+
+// ----------------------------------------------------------------------------
+// Releases the texture coordinates, faces and bone weights of an imported mesh
+// once they are held by its CompactMesh and SkinTable. The indices of a
+// cached scene are one block of the mapping.
+void releaseConvertedArrays(aiMesh* mesh)
+{
+	for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++)
+	{
+		releaseSceneArray(mesh->mTextureCoords[k], mesh->mNumVertices);
+		mesh->mNumUVComponents[k] = 0;
+	}
+	if (mesh->mFaces != NULL && mesh->mNumFaces > 0 && inCacheMapping(mesh->mFaces[0].mIndices))
+	{
+		size_t numIndices = 0;
+		for (unsigned int f = 0; f < mesh->mNumFaces; f++) numIndices += mesh->mFaces[f].mNumIndices;
+		dropCachedPages(mesh->mFaces[0].mIndices, numIndices * sizeof(unsigned int));
+		for (unsigned int f = 0; f < mesh->mNumFaces; f++) mesh->mFaces[f].mIndices = NULL;
+	}
+	delete[] mesh->mFaces;
+	mesh->mFaces = NULL;
+	mesh->mNumFaces = 0;
+	for (unsigned int b = 0; b < mesh->mNumBones; b++)
+	{
+		releaseSceneArray(mesh->mBones[b]->mWeights, mesh->mBones[b]->mNumWeights);
+		mesh->mBones[b]->mNumWeights = 0;
+	}
+}
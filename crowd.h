@@ -0,0 +1,261 @@
+// ----------------------------------------------------------------------------
+// Crowd of one character
+//
+// All instances share the scene's meshes, skeleton and clip; an instance only
+// has a placement, a phase (tick offset into the clip) and its own key
+// cursors. A crowd always plays the scene's own clip: the retargeted BVH walk
+// of the dwarf ('2') is only shown for the single character, and the floor
+// stays still under a dwarf crowd as it does for the dwarf's own clip. Poses are evaluated in batches of instances on the worker pool,
+// each batch with its own scratch arrays for the local and global transforms,
+// into one flat palette array that is drawn with instanced draws (see
+// drawGPUSkinCrowdItem() in gpu_skinning.h).
+//
+// The palette block of an instance holds, for every mesh drawn by a node
+// (a "draw item"), the bone matrices followed by one rigid matrix for vertices
+// without weights. The placement of the instance and the transform of the
+// mesh node are folded into all of them, so the items are drawn with the
+// world modelview matrix only.
+//
+// Instances are culled before their pose is evaluated, against a box that
+// holds the character in every frame of its clip; only the visible ones get
+// a palette block (packed in the order of the visible list) and are drawn.
+// Each also gets a level of detail from the screen size of that box, and the
+// visible list is grouped by level so that every level is one instanced draw
+// per item.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+#define CROWD_BATCH 8 //Instances per pool task
+
+struct CrowdInstance
+{
+	aiVector3D position; //On the floor, in world units
+	float heading;       //Rotation about the vertical axis (radians)
+	int phase;           //Tick offset into the clip
+	int level;           //Level of detail (kept while culled, for the hysteresis)
+};
+
+struct CrowdDrawItem
+{
+	int mesh;
+	int node;   //Skeleton node that draws the mesh
+	int offset; //First palette entry of the item within an instance block
+};
+
+struct Crowd
+{
+	int scene;
+	int stride;                                      //Palette entries per instance
+	std::vector<CrowdDrawItem> items;
+	std::vector<aiMatrix4x4> bindLocal;              //Local transforms of the nodes no channel drives
+	std::vector<CrowdInstance> instances;
+	std::vector< std::vector<KeyCursor> > cursors;   //Per instance, per channel
+	std::vector<float> palettes;                     //instances * stride * 12 floats
+	std::vector< std::vector<aiMatrix4x4> > scratch; //Per batch: local then global transforms
+	Box clipBounds;                                  //The character in every frame of the clip (root space)
+	std::vector<int> visible;                        //Instances drawn, in palette block order
+	int levelStart[MAX_LOD_LEVELS + 1];              //Visible instances of level l: [levelStart[l], levelStart[l + 1])
+};
+
+// ----------------------------------------------------------------------------
+// Global transforms of the skeleton at the given tick of the scene's clip.
+// local and global are arrays of numNodes matrices.
+void poseCrowdSkeleton(const Crowd* crowd, double t, KeyCursor* cursors, aiMatrix4x4* local, aiMatrix4x4* global)
+{
+	int scene = crowd->scene;
+	const Skeleton* skel = &skeletons[scene];
+	const aiAnimation* anim = animations[scene];
+	for (int n = 0; n < skel->numNodes; n++) local[n] = crowd->bindLocal[n];
+	for (unsigned int c = 0; c < anim->mNumChannels; c++)
+	{
+		int nd = channelNodes[scene][c];
+		if (nd < 0 || channelSkipped(scene, c)) continue;
+		if (useBakedPoses && bakedClips[scene].numFrames > 0)
+			local[nd] = sampleBakedClip(&bakedClips[scene], c, t);
+		else if (useCompressedClips)
+			local[nd] = sampleCompressedChannel(&compressedClips[scene], c, t, &cursors[c]);
+		else
+			local[nd] = sampleChannel(anim->mChannels[c], t, &cursors[c], scene == 0);
+	}
+	global[0] = local[0];
+	for (int n = 1; n < skel->numNodes; n++) global[n] = global[skel->parent[n]] * local[n];
+}
+
+// ----------------------------------------------------------------------------
+// Union of the animated boxes of the character over its clip
+void computeClipBounds(Crowd* crowd)
+{
+	int scene = crowd->scene;
+	const Skeleton* skel = &skeletons[scene];
+	std::vector<aiMatrix4x4> local(skel->numNodes), global(skel->numNodes);
+	std::vector<KeyCursor> cursors(animations[scene]->mNumChannels, KeyCursor());
+	crowd->clipBounds = Box();
+	for (double t = 0; t < aisgl_max(tDuration[scene], 1); t += 0.5) //Half ticks for the slerped rotations
+	{
+		poseCrowdSkeleton(crowd, t, cursors.data(), local.data(), global.data());
+		for (unsigned int k = 0; k < crowd->items.size(); k++)
+		{
+			const CrowdDrawItem& item = crowd->items[k];
+			const aiMesh* mesh = scenes[scene]->mMeshes[item.mesh];
+			Box box = skinBounds[scene].rigid[item.mesh];
+			for (unsigned int b = 0; b < mesh->mNumBones; b++)
+			{
+				int nd = skel->boneNode[item.mesh][b];
+				aiMatrix4x4 m = nd < 0 ? mesh->mBones[b]->mOffsetMatrix : global[nd] * mesh->mBones[b]->mOffsetMatrix;
+				unionBox(&box, transformBox(m, skinBounds[scene].bone[item.mesh][b]));
+			}
+			unionBox(&crowd->clipBounds, transformBox(global[item.node], box));
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+void buildCrowd(int scene, Crowd* crowd)
+{
+	const Skeleton* skel = &skeletons[scene];
+	crowd->scene = scene;
+	crowd->items.clear();
+	crowd->stride = 0;
+	for (int n = 0; n < skel->numNodes; n++)
+	{
+		const aiNode* node = skel->nodes[n];
+		for (unsigned int k = 0; k < node->mNumMeshes; k++)
+		{
+			CrowdDrawItem item = { (int)node->mMeshes[k], n, crowd->stride };
+			crowd->items.push_back(item);
+			crowd->stride += scenes[scene]->mMeshes[item.mesh]->mNumBones + 1;
+		}
+	}
+	crowd->bindLocal.resize(skel->numNodes);
+	for (int n = 0; n < skel->numNodes; n++) crowd->bindLocal[n] = skel->nodes[n]->mTransformation;
+	crowd->instances.clear();
+	crowd->visible.clear();
+	computeClipBounds(crowd);
+}
+
+// ----------------------------------------------------------------------------
+// Transform from the scene's root to the floor position of an instance
+aiMatrix4x4 instancePlacement(const CrowdInstance* inst, const aiMatrix4x4& sceneToWorld)
+{
+	aiMatrix4x4 place, rot;
+	aiMatrix4x4::Translation(inst->position, place);
+	aiMatrix4x4::RotationY(inst->heading, rot);
+	return place * rot * sceneToWorld;
+}
+
+// ----------------------------------------------------------------------------
+// Places count instances on a square grid centred on the origin. With scatter
+// the instances are jittered within their cells and get random headings.
+// Every instance starts at a random phase of the clip.
+void layoutCrowd(Crowd* crowd, int count, float spacing, bool scatter)
+{
+	int numChannels = animations[crowd->scene]->mNumChannels;
+	int side = (int)ceil(sqrt((double)count));
+	srand(1);
+	crowd->instances.resize(count);
+	crowd->cursors.assign(count, std::vector<KeyCursor>(numChannels, KeyCursor()));
+	for (int i = 0; i < count; i++)
+	{
+		CrowdInstance* inst = &crowd->instances[i];
+		float x = (i % side - (side - 1) * 0.5f) * spacing;
+		float z = (i / side - (side - 1) * 0.5f) * spacing;
+		inst->heading = 0;
+		inst->level = 0;
+		if (scatter)
+		{
+			x += (rand() / (float)RAND_MAX - 0.5f) * spacing * 0.5f;
+			z += (rand() / (float)RAND_MAX - 0.5f) * spacing * 0.5f;
+			inst->heading = (rand() / (float)RAND_MAX - 0.5f) * 0.6f;
+		}
+		inst->position = aiVector3D(x, 0, z);
+		inst->phase = i == 0 ? 0 : rand() % aisgl_max(tDuration[crowd->scene], 1);
+	}
+	int numBatches = (count + CROWD_BATCH - 1) / CROWD_BATCH;
+	crowd->scratch.assign(numBatches, std::vector<aiMatrix4x4>(2 * skeletons[crowd->scene].numNodes));
+	crowd->palettes.resize((size_t)count * crowd->stride * 12);
+	crowd->visible.resize(count);
+	for (int i = 0; i < count; i++) crowd->visible[i] = i;
+	crowd->levelStart[0] = 0;
+	for (int l = 1; l <= MAX_LOD_LEVELS; l++) crowd->levelStart[l] = count;
+}
+
+// ----------------------------------------------------------------------------
+// Rebuilds the visible list for the view (worldToClip maps floor coordinates
+// to clip space), or lists every instance when cull is false, grouped by the
+// level of detail of each instance for a viewport of the given height.
+// Returns true if the list changed.
+bool cullCrowd(Crowd* crowd, bool cull, const aiMatrix4x4& worldToClip, const aiMatrix4x4& sceneToWorld,
+	float viewportHeight)
+{
+	int numLevels = numSceneLevels(crowd->scene);
+	std::vector<int> byLevel[MAX_LOD_LEVELS];
+	for (unsigned int i = 0; i < crowd->instances.size(); i++)
+	{
+		CrowdInstance* inst = &crowd->instances[i];
+		aiMatrix4x4 toClip = worldToClip * instancePlacement(inst, sceneToWorld);
+		if (cull && boxOutsideFrustum(toClip, crowd->clipBounds)) continue;
+		inst->level = useLOD ? selectLevel(inst->level, projectedSize(toClip, crowd->clipBounds, viewportHeight),
+			lodPixels, numLevels) : 0;
+		byLevel[inst->level].push_back(i);
+	}
+	std::vector<int> visible;
+	visible.reserve(crowd->instances.size());
+	for (int l = 0; l < MAX_LOD_LEVELS; l++)
+	{
+		crowd->levelStart[l] = visible.size();
+		visible.insert(visible.end(), byLevel[l].begin(), byLevel[l].end());
+	}
+	crowd->levelStart[MAX_LOD_LEVELS] = visible.size();
+	if (visible == crowd->visible) return false;
+	crowd->visible.swap(visible);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Pose of instance i at the given tick of the scene's clip into palette
+// block j. local and global are scratch arrays of numNodes matrices.
+void evaluateCrowdInstance(Crowd* crowd, int i, int j, double tick, const aiMatrix4x4& sceneToWorld,
+	aiMatrix4x4* local, aiMatrix4x4* global)
+{
+	int scene = crowd->scene;
+	const Skeleton* skel = &skeletons[scene];
+	const CrowdInstance* inst = &crowd->instances[i];
+	double t = fmod(tick + inst->phase, aisgl_max(tDuration[scene], 1));
+	poseCrowdSkeleton(crowd, t, crowd->cursors[i].data(), local, global);
+
+	aiMatrix4x4 place = instancePlacement(inst, sceneToWorld);
+	float* block = &crowd->palettes[(size_t)j * crowd->stride * 12];
+	for (unsigned int k = 0; k < crowd->items.size(); k++)
+	{
+		const CrowdDrawItem& item = crowd->items[k];
+		const aiMesh* mesh = scenes[scene]->mMeshes[item.mesh];
+		aiMatrix4x4 itemMat = place * global[item.node];
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
+		{
+			int nd = skel->boneNode[item.mesh][b];
+			aiMatrix4x4 m = itemMat * (nd < 0 ? mesh->mBones[b]->mOffsetMatrix : global[nd] * mesh->mBones[b]->mOffsetMatrix);
+			memcpy(block + (item.offset + b) * 12, &m.a1, 12 * sizeof(float));
+		}
+		memcpy(block + (item.offset + mesh->mNumBones) * 12, &itemMat.a1, 12 * sizeof(float));
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Palettes of the visible instances at the given tick. sceneToWorld is the
+// transform from the scene's root to the floor, applied before each instance
+// placement.
+void evaluateCrowd(Crowd* crowd, double tick, const aiMatrix4x4& sceneToWorld)
+{
+	PROFILE_SCOPE("evaluateCrowd");
+	int numNodes = skeletons[crowd->scene].numNodes;
+	int count = crowd->visible.size();
+	pool->run((count + CROWD_BATCH - 1) / CROWD_BATCH, [&](int batch) {
+		aiMatrix4x4* local = crowd->scratch[batch].data();
+		int end = aisgl_min((batch + 1) * CROWD_BATCH, count);
+		for (int j = batch * CROWD_BATCH; j < end; j++)
+			evaluateCrowdInstance(crowd, crowd->visible[j], j, tick, sceneToWorld, local, local + numNodes);
+	});
+}
@@ -0,0 +1,139 @@
+// ----------------------------------------------------------------------------
+// Flat draw lists
+//
+// Each scene is compiled once, after its textures are uploaded, into a draw
+// list: the nodes of the scene graph in depth-first order (every parent before
+// its children) and one draw per mesh of a node, with the colour and texture
+// of its material already resolved. The draws are sorted by texture so that
+// meshes sharing one are drawn together.
+//
+// Every frame one linear pass over the nodes composes their (animated)
+// transforms with the scene's modelview matrix, and the draws are issued with
+// one glLoadMatrixf per change of node. A DrawState remembers the texture,
+// texture enable and colour last set so that unchanged state is not set again.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <algorithm>
+
+struct DrawMaterial
+{
+	bool textured;       //The mesh has texture coordinates
+	GLuint texture;      //Texture object (0 if there is none or it couldn't be loaded)
+	bool vertexColours;  //The colour array replaces the current colour
+	float colour[4];
+};
+
+struct DrawItem
+{
+	int mesh;
+	int node; //Index into DrawList::nodes
+};
+
+struct DrawList
+{
+	std::vector<const aiNode*> nodes;  //Depth-first: parents come before their children
+	std::vector<int> parents;          //Index of the parent node, -1 for the root
+	std::vector<aiMatrix4x4> matrices; //Node to view transforms of the current frame (column-major)
+	std::vector<DrawMaterial> materials; //Per mesh
+	std::vector<DrawItem> items;       //Sorted by material
+};
+
+struct DrawState
+{
+	int textureEnabled; //-1 while unknown
+	bool textureKnown;
+	GLuint texture;
+	bool colourKnown;
+	float colour[4];
+	DrawState() : textureEnabled(-1), textureKnown(false), texture(0), colourKnown(false) {}
+};
+
+// ----------------------------------------------------------------------------
+void flattenNodes(const aiNode* nd, int parent, DrawList* list)
+{
+	int index = list->nodes.size();
+	list->nodes.push_back(nd);
+	list->parents.push_back(parent);
+	for (unsigned int n = 0; n < nd->mNumMeshes; n++)
+	{
+		DrawItem item = { (int)nd->mMeshes[n], index };
+		list->items.push_back(item);
+	}
+	for (unsigned int i = 0; i < nd->mNumChildren; i++) flattenNodes(nd->mChildren[i], index, list);
+}
+
+// Untextured draws first, then by texture and colour source; the node keeps
+// draws of one node together within a material
+bool drawItemLess(const DrawList* list, const DrawItem& a, const DrawItem& b)
+{
+	const DrawMaterial& ma = list->materials[a.mesh];
+	const DrawMaterial& mb = list->materials[b.mesh];
+	if (ma.textured != mb.textured) return !ma.textured;
+	if (ma.texture != mb.texture) return ma.texture < mb.texture;
+	if (ma.vertexColours != mb.vertexColours) return !ma.vertexColours;
+	return a.node < b.node;
+}
+
+// Builds the node order and draws of a scene; materials must hold the
+// resolved material of every mesh
+void buildDrawList(const aiScene* scene, DrawList* list)
+{
+	list->nodes.clear();
+	list->parents.clear();
+	list->items.clear();
+	flattenNodes(scene->mRootNode, -1, list);
+	list->matrices.resize(list->nodes.size());
+	std::stable_sort(list->items.begin(), list->items.end(),
+		[list](const DrawItem& a, const DrawItem& b) { return drawItemLess(list, a, b); });
+}
+
+// ----------------------------------------------------------------------------
+// view: the transform of the scene's root space to eye space
+void updateDrawMatrices(DrawList* list, const aiMatrix4x4& view)
+{
+	PROFILE_SCOPE("updateDrawMatrices");
+	std::vector<aiMatrix4x4>& m = list->matrices;
+	for (unsigned int i = 0; i < list->nodes.size(); i++)
+	{
+		int parent = list->parents[i];
+		m[i] = (parent < 0 ? view : m[parent]) * list->nodes[i]->mTransformation; //Parents are still row-major here
+	}
+	for (unsigned int i = 0; i < m.size(); i++) m[i].Transpose();
+}
+
+// ----------------------------------------------------------------------------
+void applyDrawMaterial(const DrawMaterial* mtl, DrawState* state)
+{
+	if (state->textureEnabled != (int)mtl->textured)
+	{
+		if (mtl->textured) glEnable(GL_TEXTURE_2D);
+		else glDisable(GL_TEXTURE_2D);
+		state->textureEnabled = mtl->textured;
+		PROFILE_COUNT(PROFILE_STATE_CHANGES, 1);
+	}
+	if (mtl->textured && (!state->textureKnown || state->texture != mtl->texture))
+	{
+		glBindTexture(GL_TEXTURE_2D, mtl->texture);
+		state->texture = mtl->texture;
+		state->textureKnown = true;
+		PROFILE_COUNT(PROFILE_STATE_CHANGES, 1);
+	}
+	if (!state->colourKnown || memcmp(state->colour, mtl->colour, sizeof(mtl->colour)) != 0)
+	{
+		glColor4fv(mtl->colour);
+		memcpy(state->colour, mtl->colour, sizeof(mtl->colour));
+		state->colourKnown = true;
+		PROFILE_COUNT(PROFILE_STATE_CHANGES, 1);
+	}
+	//The current colour is undefined after drawing with a colour array
+	if (mtl->vertexColours) state->colourKnown = false;
+}
+
+// Loads the modelview matrix of a node unless it is loaded already
+void applyDrawNode(const DrawList* list, int node, int* loadedNode)
+{
+	if (*loadedNode == node) return;
+	glLoadMatrixf((const float*)&list->matrices[node]);
+	*loadedNode = node;
+}
@@ -0,0 +1,152 @@
+// ----------------------------------------------------------------------------
+// Static checkerboard floor
+//
+// The floor is built once into a vertex buffer as square blocks of tiles. A
+// block that would be drawn with tiles thinner than a couple of pixels (they
+// are foreshortened by the grazing view) is replaced by a single quad in the
+// average colour of its tiles, and blocks behind the camera or beyond the far
+// plane are not drawn at all. Scrolling is a translation of the whole floor.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cmath>
+
+#define FLOOR_TILE 50         //Tile size in model units
+#define FLOOR_HALF_TILES 100  //Tiles on each side of the origin
+#define FLOOR_BLOCK 16        //Tiles per block side
+
+struct FloorVertex
+{
+	float x, y, z;
+	float r, g, b, a;
+};
+
+struct FloorBlock
+{
+	GLint first;     //Tiles of the block (GL_QUADS)
+	GLsizei count;
+	GLint lodFirst;  //Single quad replacing the tiles
+	float minX, maxX, minZ, maxZ;
+};
+
+struct Floor
+{
+	GLuint vao;
+	GLuint vbo;
+	float height;
+	std::vector<FloorBlock> blocks;
+};
+
+const float floorColours[2][4] = { { 0.22, 0.89, 0.94, 1.0 }, { 0.93, 0.73, 0.67, 1.0 } };
+
+// ----------------------------------------------------------------------------
+void addFloorQuad(std::vector<FloorVertex>* verts, float x0, float z0, float x1, float z1, float height, const float* col)
+{
+	FloorVertex v = { 0, height, 0, col[0], col[1], col[2], col[3] };
+	v.x = x0; v.z = z0; verts->push_back(v);
+	v.x = x0; v.z = z1; verts->push_back(v);
+	v.x = x1; v.z = z1; verts->push_back(v);
+	v.x = x1; v.z = z0; verts->push_back(v);
+}
+
+// ----------------------------------------------------------------------------
+void createFloor(float height, Floor* floor)
+{
+	std::vector<FloorVertex> verts, lodVerts;
+	int numTiles = 2 * FLOOR_HALF_TILES + 1;
+	float origin = -FLOOR_HALF_TILES * FLOOR_TILE;
+	floor->height = height;
+	floor->blocks.clear();
+	for (int bx = 0; bx < numTiles; bx += FLOOR_BLOCK)
+	{
+		for (int bz = 0; bz < numTiles; bz += FLOOR_BLOCK)
+		{
+			FloorBlock block;
+			block.first = verts.size();
+			int endX = aisgl_min(bx + FLOOR_BLOCK, numTiles), endZ = aisgl_min(bz + FLOOR_BLOCK, numTiles);
+			float avg[4] = { 0 };
+			for (int i = bx; i < endX; i++)
+			{
+				for (int j = bz; j < endZ; j++)
+				{
+					const float* col = floorColours[(i + j) % 2];
+					float x = origin + i * FLOOR_TILE, z = origin + j * FLOOR_TILE;
+					addFloorQuad(&verts, x, z, x + FLOOR_TILE, z + FLOOR_TILE, height, col);
+					for (int c = 0; c < 4; c++) avg[c] += col[c];
+				}
+			}
+			block.count = verts.size() - block.first;
+			for (int c = 0; c < 4; c++) avg[c] /= (endX - bx) * (endZ - bz);
+			block.minX = origin + bx * FLOOR_TILE;
+			block.maxX = origin + endX * FLOOR_TILE;
+			block.minZ = origin + bz * FLOOR_TILE;
+			block.maxZ = origin + endZ * FLOOR_TILE;
+			block.lodFirst = lodVerts.size(); //Offset by the tile count below
+			addFloorQuad(&lodVerts, block.minX, block.minZ, block.maxX, block.maxZ, height, avg);
+			floor->blocks.push_back(block);
+		}
+	}
+	for (unsigned int b = 0; b < floor->blocks.size(); b++) floor->blocks[b].lodFirst += verts.size();
+	verts.insert(verts.end(), lodVerts.begin(), lodVerts.end());
+
+	glGenVertexArrays(1, &floor->vao);
+	glGenBuffers(1, &floor->vbo);
+	glBindVertexArray(floor->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, floor->vbo);
+	glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(FloorVertex), verts.data(), GL_STATIC_DRAW);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(FloorVertex), (void*)0);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glColorPointer(4, GL_FLOAT, sizeof(FloorVertex), (void*)(3 * sizeof(float)));
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// eye and viewDir are in floor coordinates (after the scroll translation).
+// pixelsPerUnit is the projected size in pixels of one unit at unit distance.
+// Returns the number of quads submitted.
+int drawFloorBlocks(const Floor* floor, aiVector3D eye, aiVector3D viewDir, float pixelsPerUnit, float farDistance)
+{
+	const float minTilePixels = 2;
+	float eyeHeight = aisgl_max(fabs(eye.y - floor->height), 1.0f);
+	int quads = 0;
+	glBindVertexArray(floor->vao);
+	glNormal3f(0, -1, 0);
+	for (unsigned int b = 0; b < floor->blocks.size(); b++)
+	{
+		const FloorBlock* block = &floor->blocks[b];
+
+		//Skip the block if all its corners are behind the camera
+		bool visible = false;
+		for (int c = 0; c < 4 && !visible; c++)
+		{
+			aiVector3D corner((c & 1) ? block->maxX : block->minX, floor->height, (c & 2) ? block->maxZ : block->minZ);
+			visible = (corner - eye) * viewDir > 0;
+		}
+		if (!visible) continue;
+
+		//Nearest point of the block
+		float dx = aisgl_max(aisgl_max(block->minX - eye.x, eye.x - block->maxX), 0.0f);
+		float dz = aisgl_max(aisgl_max(block->minZ - eye.z, eye.z - block->maxZ), 0.0f);
+		float dist2 = dx * dx + dz * dz + eyeHeight * eyeHeight;
+		if (dist2 > farDistance * farDistance) continue;
+
+		//Depth of a tile on screen shrinks with the grazing angle: size * height / dist^2
+		float tilePixels = FLOOR_TILE * pixelsPerUnit * eyeHeight / dist2;
+		if (tilePixels < minTilePixels)
+		{
+			glDrawArrays(GL_QUADS, block->lodFirst, 4);
+			PROFILE_COUNT(PROFILE_DRAW_CALLS, 1);
+			quads++;
+		}
+		else
+		{
+			glDrawArrays(GL_QUADS, block->first, block->count);
+			PROFILE_COUNT(PROFILE_DRAW_CALLS, 1);
+			quads += block->count / 4;
+		}
+	}
+	glBindVertexArray(0);
+	return quads;
+}
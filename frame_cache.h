@@ -0,0 +1,152 @@
+// ----------------------------------------------------------------------------
+// Skinned frame cache
+//
+// The clips are loops, so the CPU path skins the same vertices again on every
+// cycle. With the cache enabled (--frame-cache) animation time is sampled at
+// whole frames, and the skinned positions and normals of all meshes of a
+// scene are kept per frame once computed; later cycles copy them back instead
+// of skinning. Every scene has its own cache, but they share one memory
+// budget: when it is exceeded the least recently used frame of any scene is
+// evicted. A list shared by the scenes keeps the frames in order of use, so
+// finding and evicting the oldest one takes constant time.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <map>
+#include <list>
+
+struct FrameKey
+{
+	long frame;       //Frame of the scene's clip
+	long sourceFrame; //Frame of the retargeted clip, -1 when not playing
+	bool baked;
+	int level;        //Level of detail skinned (only its vertices are valid)
+
+	bool operator<(const FrameKey& k) const
+	{
+		if (frame != k.frame) return frame < k.frame;
+		if (sourceFrame != k.sourceFrame) return sourceFrame < k.sourceFrame;
+		if (level != k.level) return level < k.level;
+		return baked < k.baked;
+	}
+};
+
+struct SkinnedFrame;
+typedef std::map<FrameKey, SkinnedFrame> SkinnedFrameMap;
+typedef std::list<std::pair<int, SkinnedFrameMap::iterator> > FrameUseList; //Scene and frame
+
+struct SkinnedFrame
+{
+	std::vector<aiVector3D> data;  //Positions then normals of every mesh
+	FrameUseList::iterator use;    //Entry in frameCacheUses
+};
+
+struct FrameCache
+{
+	SkinnedFrameMap frames;
+	size_t bytes;
+	long hits, misses, evictions;
+
+	FrameCache() : bytes(0), hits(0), misses(0), evictions(0) {}
+};
+
+FrameCache frameCaches[3];
+size_t frameCacheBudget = 256 << 20; //Bytes shared by all scenes
+FrameUseList frameCacheUses; //Cached frames of all scenes, most recently used first
+
+// ----------------------------------------------------------------------------
+size_t frameCacheBytes()
+{
+	size_t total = 0;
+	for (int s = 0; s < 3; s++) total += frameCaches[s].bytes;
+	return total;
+}
+
+// ----------------------------------------------------------------------------
+// Removes the least recently used frame of all scenes. Returns false if all
+// caches are empty.
+bool evictOldestFrame()
+{
+	if (frameCacheUses.empty()) return false;
+	FrameCache* oldestCache = &frameCaches[frameCacheUses.back().first];
+	SkinnedFrameMap::iterator oldest = frameCacheUses.back().second;
+	frameCacheUses.pop_back();
+	oldestCache->bytes -= oldest->second.data.size() * sizeof(aiVector3D);
+	oldestCache->frames.erase(oldest);
+	oldestCache->evictions++;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Copies a cached frame into the meshes of the scene. Returns false (a miss)
+// if the frame is not in the cache.
+bool fetchSkinnedFrame(int index, const aiScene* scene, const FrameKey& key)
+{
+	FrameCache* cache = &frameCaches[index];
+	SkinnedFrameMap::iterator it = cache->frames.find(key);
+	if (it == cache->frames.end())
+	{
+		cache->misses++;
+		return false;
+	}
+	cache->hits++;
+	frameCacheUses.splice(frameCacheUses.begin(), frameCacheUses, it->second.use);
+	const aiVector3D* src = it->second.data.data();
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+		memcpy(mesh->mVertices, src, mesh->mNumVertices * sizeof(aiVector3D));
+		src += mesh->mNumVertices;
+		memcpy(mesh->mNormals, src, mesh->mNumVertices * sizeof(aiVector3D));
+		src += mesh->mNumVertices;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Stores the current skinned vertices of the scene's meshes as the given frame
+void storeSkinnedFrame(int index, const aiScene* scene, const FrameKey& key)
+{
+	size_t numVectors = 0;
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++) numVectors += 2 * scene->mMeshes[m]->mNumVertices;
+	size_t size = numVectors * sizeof(aiVector3D);
+	if (size > frameCacheBudget) return;
+	while (frameCacheBytes() + size > frameCacheBudget && evictOldestFrame()) {}
+
+	FrameCache* cache = &frameCaches[index];
+	std::pair<SkinnedFrameMap::iterator, bool> inserted = cache->frames.insert(std::make_pair(key, SkinnedFrame()));
+	SkinnedFrame* frame = &inserted.first->second;
+	if (inserted.second)
+	{
+		frameCacheUses.push_front(std::make_pair(index, inserted.first));
+		frame->use = frameCacheUses.begin();
+	}
+	else
+		frameCacheUses.splice(frameCacheUses.begin(), frameCacheUses, frame->use);
+	cache->bytes += size - frame->data.size() * sizeof(aiVector3D);
+	frame->data.resize(numVectors);
+	aiVector3D* dst = frame->data.data();
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		const aiMesh* mesh = scene->mMeshes[m];
+		memcpy(dst, mesh->mVertices, mesh->mNumVertices * sizeof(aiVector3D));
+		dst += mesh->mNumVertices;
+		memcpy(dst, mesh->mNormals, mesh->mNumVertices * sizeof(aiVector3D));
+		dst += mesh->mNumVertices;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void printFrameCacheStats(const char* const* names)
+{
+	for (int s = 0; s < 3; s++)
+	{
+		const FrameCache* cache = &frameCaches[s];
+		long lookups = cache->hits + cache->misses;
+		cout << "Frame cache " << names[s] << ": " << cache->frames.size() << " frames, "
+			<< cache->bytes / 1048576.0 << " MB, " << cache->hits << " hits, " << cache->misses << " misses ("
+			<< (lookups > 0 ? 100.0 * cache->hits / lookups : 0) << "% hit rate), " << cache->evictions << " evictions"
+			<< endl;
+	}
+	cout << "Frame cache total: " << frameCacheBytes() / 1048576.0 << " of " << frameCacheBudget / 1048576.0 << " MB" << endl;
+}
@@ -0,0 +1,116 @@
+// ----------------------------------------------------------------------------
+// GPU-resident meshes
+//
+// Each mesh is uploaded once into an index buffer and vertex buffers and drawn
+// with a single glDrawElements call through a vertex array object (fixed
+// function client arrays are part of VAO state in a compatibility context).
+// Texture coordinates and vertex colours never change and live in a static
+// buffer; positions and normals are rewritten after every skinning pass,
+// orphaning the previous buffer storage so the driver never stalls on it.
+// Indices and texture coordinates come from the mesh's CompactMesh; indices
+// stay 16-bit when it has them. The index buffer holds every level of detail
+// of the mesh (see lod.h), and a draw takes the range of one of them.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+
+struct GLMesh
+{
+	GLuint vao;
+	GLuint staticVbo;  //Texture coordinates and vertex colours
+	GLuint dynamicVbo; //Positions followed by normals
+	GLuint ibo;
+	GLenum mode;       //GL_POINTS, GL_LINES or GL_TRIANGLES
+	GLenum indexType;  //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	GLsizei numIndices;
+	int numVertices;
+};
+
+// ----------------------------------------------------------------------------
+void createGLMesh(const aiMesh* mesh, const CompactMesh* cm, GLMesh* glMesh)
+{
+	int numVert = mesh->mNumVertices;
+	glMesh->mode = cm->primitiveSize == 1 ? GL_POINTS : cm->primitiveSize == 2 ? GL_LINES : GL_TRIANGLES;
+	glMesh->indexType = cm->indices16.empty() ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+	glMesh->numIndices = cm->numIndices();
+	glMesh->numVertices = numVert;
+
+	glGenVertexArrays(1, &glMesh->vao);
+	glGenBuffers(1, &glMesh->staticVbo);
+	glGenBuffers(1, &glMesh->dynamicVbo);
+	glGenBuffers(1, &glMesh->ibo);
+	glBindVertexArray(glMesh->vao);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glMesh->ibo);
+	if (glMesh->indexType == GL_UNSIGNED_SHORT)
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, cm->indices16.size() * sizeof(GLushort), cm->indices16.data(), GL_STATIC_DRAW);
+	else
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, cm->indices32.size() * sizeof(GLuint), cm->indices32.data(), GL_STATIC_DRAW);
+
+	//Static streams: texture coordinates (2 floats) then colours
+	std::vector<float> texCoords;
+	decodeTexCoords(cm, &texCoords);
+	size_t texBytes = texCoords.size() * sizeof(float);
+	size_t colBytes = mesh->HasVertexColors(0) ? numVert * sizeof(aiColor4D) : 0;
+	glBindBuffer(GL_ARRAY_BUFFER, glMesh->staticVbo);
+	glBufferData(GL_ARRAY_BUFFER, texBytes + colBytes, NULL, GL_STATIC_DRAW);
+	if (texBytes > 0)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, 0, texBytes, texCoords.data());
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, 0, (void*)0);
+	}
+	if (colBytes > 0)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, texBytes, colBytes, mesh->mColors[0]);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(4, GL_FLOAT, 0, (void*)texBytes);
+	}
+
+	//Dynamic streams: positions then normals
+	size_t streamBytes = numVert * sizeof(aiVector3D);
+	glBindBuffer(GL_ARRAY_BUFFER, glMesh->dynamicVbo);
+	glBufferData(GL_ARRAY_BUFFER, 2 * streamBytes, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, streamBytes, mesh->mVertices);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, (void*)0);
+	if (mesh->HasNormals())
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, streamBytes, streamBytes, mesh->mNormals);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glNormalPointer(GL_FLOAT, 0, (void*)streamBytes);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Uploads the first numVertices skinned positions and normals into fresh
+// (orphaned) storage
+void updateGLMeshStreams(const aiMesh* mesh, const GLMesh* glMesh, int numVertices)
+{
+	size_t streamBytes = glMesh->numVertices * sizeof(aiVector3D);
+	size_t usedBytes = numVertices * sizeof(aiVector3D);
+	glBindBuffer(GL_ARRAY_BUFFER, glMesh->dynamicVbo);
+	glBufferData(GL_ARRAY_BUFFER, 2 * streamBytes, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, usedBytes, mesh->mVertices);
+	if (mesh->HasNormals())
+		glBufferSubData(GL_ARRAY_BUFFER, streamBytes, usedBytes, mesh->mNormals);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Offset into the index buffer of its firstIndex'th index
+void* indexOffset(const GLMesh* glMesh, int firstIndex)
+{
+	return (void*)(firstIndex * (glMesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)));
+}
+
+// ----------------------------------------------------------------------------
+void drawGLMesh(const GLMesh* glMesh, int firstIndex, int numIndices)
+{
+	glBindVertexArray(glMesh->vao);
+	glDrawElements(glMesh->mode, numIndices, glMesh->indexType, indexOffset(glMesh, firstIndex));
+	PROFILE_COUNT(PROFILE_DRAW_CALLS, 1);
+	glBindVertexArray(0);
+}
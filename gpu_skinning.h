@@ -0,0 +1,393 @@
+// ----------------------------------------------------------------------------
+// Vertex shader skinning
+//
+// The bind pose of every mesh is uploaded once together with the per-vertex
+// bone indices and weights of its SkinTable. Each frame only the bone
+// palettes of the scene (the top three rows of every bone matrix, meshes one
+// after another) are written to a texture buffer; the vertex shader blends
+// them, skins the vertex and reproduces the fixed-function lighting used by
+// the CPU path (GL_LIGHT0, colour material, two-sided lighting).
+// Crowds (crowd.h) use the same shader with instanced draws: every instance
+// reads its own block of the palette buffer, selected by gl_InstanceID (plus
+// the first instance of the draw, as instances are drawn in groups per level
+// of detail).
+// The skinned position is also a shader output that --verify-gpu-skinning
+// captures with transform feedback and compares with CPU skinning.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+
+const char* skinVertexShader =
+	"#version 330 compatibility\n"
+	"layout(location = 0) in vec3 position;\n"
+	"layout(location = 1) in vec3 normal;\n"
+	"layout(location = 2) in vec2 texCoord;\n"
+	"layout(location = 3) in vec4 vertexColour;\n"
+	"layout(location = 4) in ivec4 boneIndices;\n"
+	"layout(location = 5) in vec4 boneWeights;\n"
+	"uniform samplerBuffer palette;\n" //3 texels (matrix rows) per bone
+	"uniform int boneOffset;\n"
+	"uniform int instanceStride;\n" //Palette entries per instance (crowds), 0 otherwise
+	"uniform int firstInstance;\n"  //Palette block of the draw's first instance
+	"uniform int rigidBone;\n"      //Entry for vertices without weights, -1 for identity
+	"uniform bool hasVertexColour;\n"
+	"out vec3 skinnedPosition;\n"  //Before the modelview transform (captured for verification)
+	"vec4 lighting(vec3 n, vec3 ecPos, vec4 col)\n"
+	"{\n"
+	"    vec3 L = normalize(gl_LightSource[0].position.xyz - ecPos * gl_LightSource[0].position.w);\n"
+	"    vec3 H = normalize(L + vec3(0.0, 0.0, 1.0));\n"
+	"    float nDotL = max(dot(n, L), 0.0);\n"
+	"    vec4 c = gl_FrontMaterial.emission + col * (gl_LightModel.ambient + gl_LightSource[0].ambient)\n"
+	"        + col * gl_LightSource[0].diffuse * nDotL;\n"
+	"    if (nDotL > 0.0)\n"
+	"        c += gl_FrontMaterial.specular * gl_LightSource[0].specular\n"
+	"            * pow(max(dot(n, H), 0.0), gl_FrontMaterial.shininess);\n"
+	"    return vec4(c.rgb, col.a);\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"    vec4 r0 = vec4(1.0, 0.0, 0.0, 0.0), r1 = vec4(0.0, 1.0, 0.0, 0.0), r2 = vec4(0.0, 0.0, 1.0, 0.0);\n"
+	"    int base = (firstInstance + gl_InstanceID) * instanceStride;\n"
+	"    if (boneWeights.x > 0.0)\n"
+	"    {\n"
+	"        r0 = r1 = r2 = vec4(0.0);\n"
+	"        for (int k = 0; k < 4; k++)\n"
+	"        {\n"
+	"            int b = (base + boneOffset + boneIndices[k]) * 3;\n"
+	"            r0 += boneWeights[k] * texelFetch(palette, b);\n"
+	"            r1 += boneWeights[k] * texelFetch(palette, b + 1);\n"
+	"            r2 += boneWeights[k] * texelFetch(palette, b + 2);\n"
+	"        }\n"
+	"    }\n"
+	"    else if (rigidBone >= 0)\n"
+	"    {\n"
+	"        int b = (base + rigidBone) * 3;\n"
+	"        r0 = texelFetch(palette, b);\n"
+	"        r1 = texelFetch(palette, b + 1);\n"
+	"        r2 = texelFetch(palette, b + 2);\n"
+	"    }\n"
+	"    vec4 p = vec4(position, 1.0);\n"
+	"    skinnedPosition = vec3(dot(r0, p), dot(r1, p), dot(r2, p));\n"
+	"    vec4 ecPos = gl_ModelViewMatrix * vec4(skinnedPosition, 1.0);\n"
+	"    vec3 n = normalize(gl_NormalMatrix * vec3(dot(r0.xyz, normal), dot(r1.xyz, normal), dot(r2.xyz, normal)));\n"
+	"    vec4 col = hasVertexColour ? vertexColour : gl_Color;\n"
+	"    gl_FrontColor = lighting(n, ecPos.xyz, col);\n"
+	"    gl_BackColor = lighting(-n, ecPos.xyz, col);\n"
+	"    gl_TexCoord[0] = vec4(texCoord, 0.0, 1.0);\n"
+	"    gl_Position = gl_ProjectionMatrix * ecPos;\n"
+	"}\n";
+
+const char* skinFragmentShader =
+	"#version 330 compatibility\n"
+	"uniform sampler2D diffuseMap;\n"
+	"uniform bool useTexture;\n"
+	"void main()\n"
+	"{\n"
+	"    vec4 c = gl_Color;\n"
+	"    if (useTexture) c *= texture(diffuseMap, gl_TexCoord[0].st);\n"
+	"    gl_FragColor = c;\n"
+	"}\n";
+
+struct GPUSkinMesh
+{
+	GLuint vao;
+	GLuint vbo;
+	bool hasVertexColours;
+};
+
+struct GPUSkinScene
+{
+	GLuint paletteBuffer;
+	GLuint paletteTexture;
+	int numBones;
+	std::vector<int> boneOffset;    //Per mesh: first bone of the mesh in the palette buffer
+	std::vector<float> staging;     //numBones * 12 floats
+	std::vector<GPUSkinMesh> meshes;
+};
+
+GLuint skinProgram = 0;
+GLint locBoneOffset, locHasVertexColour, locUseTexture, locInstanceStride, locFirstInstance, locRigidBone;
+
+// ----------------------------------------------------------------------------
+GLuint compileShader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		cout << "Shader compilation failed: " << log << endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// ----------------------------------------------------------------------------
+// Returns false if the context cannot run the skinning shader (it needs
+// GL 3.3 with the compatibility profile for texture buffers and the
+// fixed-function built-ins).
+bool initGPUSkinning()
+{
+	if (!GLEW_VERSION_3_3) return false;
+	GLuint vs = compileShader(GL_VERTEX_SHADER, skinVertexShader);
+	GLuint fs = compileShader(GL_FRAGMENT_SHADER, skinFragmentShader);
+	if (vs == 0 || fs == 0) return false;
+	skinProgram = glCreateProgram();
+	glAttachShader(skinProgram, vs);
+	glAttachShader(skinProgram, fs);
+	const char* captured = "skinnedPosition";
+	glTransformFeedbackVaryings(skinProgram, 1, &captured, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(skinProgram);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	GLint status;
+	glGetProgramiv(skinProgram, GL_LINK_STATUS, &status);
+	if (!status)
+	{
+		cout << "Skinning shader failed to link" << endl;
+		glDeleteProgram(skinProgram);
+		skinProgram = 0;
+		return false;
+	}
+	glUseProgram(skinProgram);
+	glUniform1i(glGetUniformLocation(skinProgram, "diffuseMap"), 0);
+	glUniform1i(glGetUniformLocation(skinProgram, "palette"), 1);
+	locBoneOffset = glGetUniformLocation(skinProgram, "boneOffset");
+	locHasVertexColour = glGetUniformLocation(skinProgram, "hasVertexColour");
+	locUseTexture = glGetUniformLocation(skinProgram, "useTexture");
+	locInstanceStride = glGetUniformLocation(skinProgram, "instanceStride");
+	locFirstInstance = glGetUniformLocation(skinProgram, "firstInstance");
+	locRigidBone = glGetUniformLocation(skinProgram, "rigidBone");
+	glUseProgram(0);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Uploads the bind pose (decoded from the compact meshes) and skin table of
+// every mesh. The index buffers are shared with the meshes of the CPU path.
+void createGPUSkinScene(const aiScene* scene, const std::vector<CompactMesh>& compact, const std::vector<SkinTable>& tables,
+	const std::vector<GLMesh>& glMeshes, GPUSkinScene* gpu)
+{
+	std::vector<aiVector3D> bindVerts, bindNormals;
+	std::vector<float> texCoords;
+	gpu->numBones = 0;
+	gpu->boneOffset.resize(scene->mNumMeshes);
+	gpu->meshes.resize(scene->mNumMeshes);
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		const aiMesh* mesh = scene->mMeshes[m];
+		const SkinTable* table = &tables[m];
+		GPUSkinMesh* gm = &gpu->meshes[m];
+		int numVert = compact[m].numVertices;
+		decodePositions(&compact[m], &bindVerts);
+		decodeNormals(&compact[m], &bindNormals);
+		decodeTexCoords(&compact[m], &texCoords);
+		gpu->boneOffset[m] = gpu->numBones;
+		gpu->numBones += mesh->mNumBones;
+
+		size_t vecBytes = numVert * sizeof(aiVector3D);
+		size_t texBytes = texCoords.size() * sizeof(float);
+		size_t colBytes = mesh->HasVertexColors(0) ? numVert * sizeof(aiColor4D) : 0;
+		size_t boneBytes = table->bones.size() * sizeof(unsigned short);
+		size_t weightBytes = table->weights.size() * sizeof(float);
+		size_t offset = 0;
+		gm->hasVertexColours = colBytes > 0;
+
+		glGenVertexArrays(1, &gm->vao);
+		glGenBuffers(1, &gm->vbo);
+		glBindVertexArray(gm->vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glMeshes[m].ibo);
+		glBindBuffer(GL_ARRAY_BUFFER, gm->vbo);
+		glBufferData(GL_ARRAY_BUFFER, 2 * vecBytes + texBytes + colBytes + boneBytes + weightBytes, NULL, GL_STATIC_DRAW);
+
+		glBufferSubData(GL_ARRAY_BUFFER, offset, vecBytes, bindVerts.data());
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+		offset += vecBytes;
+		glBufferSubData(GL_ARRAY_BUFFER, offset, vecBytes, bindNormals.data());
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+		offset += vecBytes;
+		if (texBytes > 0)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, offset, texBytes, texCoords.data());
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+			offset += texBytes;
+		}
+		if (colBytes > 0)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, offset, colBytes, mesh->mColors[0]);
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+			offset += colBytes;
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, offset, boneBytes, table->bones.data());
+		glEnableVertexAttribArray(4);
+		glVertexAttribIPointer(4, MAX_INFLUENCES, GL_UNSIGNED_SHORT, 0, (void*)offset);
+		offset += boneBytes;
+		glBufferSubData(GL_ARRAY_BUFFER, offset, weightBytes, table->weights.data());
+		glEnableVertexAttribArray(5);
+		glVertexAttribPointer(5, MAX_INFLUENCES, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+	}
+	glBindVertexArray(0);
+
+	gpu->staging.resize(gpu->numBones * 12 + 12);
+	glGenBuffers(1, &gpu->paletteBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, gpu->paletteBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, gpu->staging.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+	glGenTextures(1, &gpu->paletteTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, gpu->paletteTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gpu->paletteBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Copies the current bone palettes of the skeleton into the texture buffer
+void uploadBonePalettes(const aiScene* scene, const Skeleton* skel, GPUSkinScene* gpu)
+{
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+		for (unsigned int b = 0; b < scene->mMeshes[m]->mNumBones; b++)
+			memcpy(&gpu->staging[(gpu->boneOffset[m] + b) * 12], &skel->palette[m][b].a1, 12 * sizeof(float));
+	glBindBuffer(GL_TEXTURE_BUFFER, gpu->paletteBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, gpu->staging.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, gpu->staging.size() * sizeof(float), gpu->staging.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+void beginGPUSkinning(const GPUSkinScene* gpu, bool twoSided)
+{
+	glUseProgram(skinProgram);
+	glUniform1i(locInstanceStride, 0);
+	glUniform1i(locFirstInstance, 0);
+	glUniform1i(locRigidBone, -1);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, gpu->paletteTexture);
+	glActiveTexture(GL_TEXTURE0);
+	if (twoSided) glEnable(GL_VERTEX_PROGRAM_TWO_SIDE);
+}
+
+// ----------------------------------------------------------------------------
+// Draws numIndices indices of the mesh from firstIndex (one level of detail)
+void drawGPUSkinMesh(const GPUSkinScene* gpu, int meshIndex, const GLMesh* glMesh, bool textured,
+	int firstIndex, int numIndices)
+{
+	const GPUSkinMesh* gm = &gpu->meshes[meshIndex];
+	glUniform1i(locBoneOffset, gpu->boneOffset[meshIndex]);
+	glUniform1i(locHasVertexColour, gm->hasVertexColours);
+	glUniform1i(locUseTexture, textured);
+	glBindVertexArray(gm->vao);
+	glDrawElements(glMesh->mode, numIndices, glMesh->indexType, indexOffset(glMesh, firstIndex));
+	PROFILE_COUNT(PROFILE_DRAW_CALLS, 1);
+	glBindVertexArray(0);
+}
+
+// ----------------------------------------------------------------------------
+// Skinned positions of all vertices of a mesh (in mesh space, as the CPU path
+// computes them), captured with transform feedback while nothing is drawn.
+// Called between beginGPUSkinning() and endGPUSkinning().
+void captureGPUSkinnedPositions(const GPUSkinScene* gpu, int meshIndex, int numVertices, std::vector<aiVector3D>* out)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+	glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, numVertices * sizeof(aiVector3D), NULL, GL_STREAM_READ);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+	glUniform1i(locBoneOffset, gpu->boneOffset[meshIndex]);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(gpu->meshes[meshIndex].vao);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, numVertices);
+	glEndTransformFeedback();
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	out->resize(numVertices);
+	glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, numVertices * sizeof(aiVector3D), out->data());
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDeleteBuffers(1, &buffer);
+}
+
+// ----------------------------------------------------------------------------
+void endGPUSkinning()
+{
+	glDisable(GL_VERTEX_PROGRAM_TWO_SIDE);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(0);
+}
+
+// ----------------------------------------------------------------------------
+// Crowds: one palette buffer holding a block of palette entries per instance
+//-----------------------------------------------------------------------------
+struct GPUCrowd
+{
+	GLuint paletteBuffer;
+	GLuint paletteTexture;
+};
+
+void createGPUCrowd(GPUCrowd* crowd)
+{
+	glGenBuffers(1, &crowd->paletteBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, crowd->paletteBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, 12 * sizeof(float), NULL, GL_STREAM_DRAW);
+	glGenTextures(1, &crowd->paletteTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, crowd->paletteTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, crowd->paletteBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Largest number of palette entries a texture buffer can hold
+int maxCrowdPaletteEntries()
+{
+	GLint texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+	return texels / 3;
+}
+
+// palettes holds 12 floats per entry
+void uploadCrowdPalettes(const GPUCrowd* crowd, const float* palettes, size_t numEntries)
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, crowd->paletteBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, numEntries * 12 * sizeof(float), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, numEntries * 12 * sizeof(float), palettes);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void beginGPUCrowd(const GPUCrowd* crowd, int stride, bool twoSided)
+{
+	glUseProgram(skinProgram);
+	glUniform1i(locInstanceStride, stride);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, crowd->paletteTexture);
+	glActiveTexture(GL_TEXTURE0);
+	if (twoSided) glEnable(GL_VERTEX_PROGRAM_TWO_SIDE);
+}
+
+// Draws one mesh (the index range of one level of detail) for the instances
+// of palette blocks [firstInstance, firstInstance + numInstances). offset is
+// the first palette entry of the mesh within an instance block; the mesh's
+// bones are followed by its rigid transform.
+void drawGPUSkinCrowdItem(const GPUSkinScene* gpu, int meshIndex, const GLMesh* glMesh, bool textured,
+	int offset, int numBones, int firstInstance, int numInstances, int firstIndex, int numIndices)
+{
+	const GPUSkinMesh* gm = &gpu->meshes[meshIndex];
+	glUniform1i(locBoneOffset, offset);
+	glUniform1i(locRigidBone, offset + numBones);
+	glUniform1i(locFirstInstance, firstInstance);
+	glUniform1i(locHasVertexColour, gm->hasVertexColours);
+	glUniform1i(locUseTexture, textured);
+	glBindVertexArray(gm->vao);
+	glDrawElementsInstanced(glMesh->mode, numIndices, glMesh->indexType, indexOffset(glMesh, firstIndex), numInstances);
+	PROFILE_COUNT(PROFILE_DRAW_CALLS, 1);
+	glBindVertexArray(0);
+}
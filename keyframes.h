@@ -0,0 +1,102 @@
+// ----------------------------------------------------------------------------
+// Keyframe lookup
+//
+// Every animation channel keeps a cursor per key track (position, rotation,
+// scaling) holding the key found by the previous lookup. Forward playback
+// advances the cursor by a few keys at most, so a lookup costs O(1) amortized
+// regardless of clip length; seeks, loops and large jumps fall back to a
+// binary search.
+//-----------------------------------------------------------------------------
+
+#define KEY_CURSOR_STEPS 4 //Keys to step forward before switching to binary search
+
+struct KeyCursor
+{
+	unsigned int position;
+	unsigned int rotation;
+	unsigned int scaling;
+};
+
+// ----------------------------------------------------------------------------
+// First key in [lo, numKeys) with mTime >= time, or the last key if none.
+template <class Key>
+unsigned int searchKey(const Key* keys, unsigned int numKeys, double time, unsigned int lo)
+{
+	unsigned int hi = numKeys - 1;
+	while (lo < hi)
+	{
+		unsigned int mid = (lo + hi) / 2;
+		if (keys[mid].mTime < time) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// ----------------------------------------------------------------------------
+// Index of the first key with mTime >= time (clamped to the last key), the
+// same key found by scanning "while (time > keys[index].mTime) index++".
+// The track must have at least one key.
+template <class Key>
+unsigned int findKey(const Key* keys, unsigned int numKeys, double time, unsigned int* cursor)
+{
+	unsigned int i = *cursor;
+	if (i >= numKeys) i = 0;
+	if (i > 0 && keys[i - 1].mTime >= time)
+		i = searchKey(keys, numKeys, time, 0); //Time went backwards (loop or seek)
+	else
+	{
+		for (int steps = 0; steps < KEY_CURSOR_STEPS && i < numKeys - 1 && keys[i].mTime < time; steps++)
+			i++;
+		if (i < numKeys - 1 && keys[i].mTime < time)
+			i = searchKey(keys, numKeys, time, i); //Jumped forward
+	}
+	*cursor = i;
+	return i;
+}
+
+// ----------------------------------------------------------------------------
+// Slerps between the key found for this time and its predecessor (the last
+// key when the first one is found, i.e. across the loop boundary).
+aiQuaternion interpolateRotation(const aiQuatKey* keys, unsigned int numKeys, unsigned int index, double time)
+{
+	if (numKeys < 2) return keys[0].mValue;
+	unsigned int prev_index = (index == 0) ? numKeys - 1 : index - 1;
+	float time1 = keys[prev_index].mTime;
+	float time2 = keys[index].mTime;
+	float factor = (time2 == time1) ? 1.0f : (time - time1) / (time2 - time1);
+	factor = aisgl_max(0.0f, aisgl_min(factor, 1.0f));
+	aiQuaternion rotn;
+	aiQuaternion::Interpolate(rotn, keys[prev_index].mValue, keys[index].mValue, factor);
+	return rotn;
+}
+
+// ----------------------------------------------------------------------------
+// Local transform of an animation channel at the given tick: translation and
+// scaling of the key found for the tick, rotation slerped between keys (or,
+// with stepRotation, the rotation key at the position key's index).
+aiMatrix4x4 sampleChannel(const aiNodeAnim* ndAnim, double tick, KeyCursor* cursor, bool stepRotation)
+{
+	aiMatrix4x4 matPos, matScl;
+	aiQuaternion rotn;
+
+	unsigned int index = findKey(ndAnim->mPositionKeys, ndAnim->mNumPositionKeys, tick, &cursor->position);
+	aiMatrix4x4::Translation(ndAnim->mPositionKeys[index].mValue, matPos);
+
+	if (ndAnim->mNumScalingKeys > 0)
+	{
+		unsigned int sclIndex = findKey(ndAnim->mScalingKeys, ndAnim->mNumScalingKeys, tick, &cursor->scaling);
+		aiMatrix4x4::Scaling(ndAnim->mScalingKeys[sclIndex].mValue, matScl);
+	}
+
+	if (ndAnim->mNumRotationKeys > 1 && stepRotation)
+		rotn = ndAnim->mRotationKeys[index].mValue;
+	else if (ndAnim->mNumRotationKeys > 1)
+	{
+		index = findKey(ndAnim->mRotationKeys, ndAnim->mNumRotationKeys, tick, &cursor->rotation);
+		rotn = interpolateRotation(ndAnim->mRotationKeys, ndAnim->mNumRotationKeys, index, tick);
+	}
+	else
+		rotn = ndAnim->mRotationKeys[0].mValue;
+
+	return matPos * aiMatrix4x4(rotn.GetMatrix()) * matScl;
+}
@@ -0,0 +1,389 @@
+// ----------------------------------------------------------------------------
+// Mesh levels of detail
+//
+// At load time every triangle mesh is simplified by half-edge collapses: a
+// vertex is merged into one of its neighbours, the pair being chosen by the
+// quadric error metric (the summed squared distances of the neighbour to the
+// planes of the original triangles around the vertex). Collapses are limited
+// so that the simplified meshes keep what the full mesh is drawn with:
+//  - Vertices on UV seams (sharing their position with another vertex) and
+//    on borders are never removed, so texture charts and outlines stay put.
+//  - A vertex is only merged into one with similar bone weights, and the
+//    difference adds to the cost, so the joints bend as in the full mesh.
+//  - Collapses that would flip or fold a triangle are rejected.
+// Levels are taken at 1/2, 1/4 and 1/8 of the vertices (fewer if the mesh
+// cannot be simplified that far). The mesh's vertices are then reordered so
+// that every level uses a prefix of them: the vertices that are never
+// removed, followed by the removed ones, last removed first. A level thus
+// only needs its prefix skinned and uploaded, and is drawn with its own range
+// of the compact mesh's indices.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <queue>
+#include <map>
+#include <cmath>
+
+#define MAX_LOD_LEVELS 4            //The full mesh and up to three simplified levels
+#define LOD_MIN_VERTICES 64         //Smaller meshes are not simplified
+#define LOD_MAX_WEIGHT_CHANGE 0.5f  //Largest bone weight difference (0..1) between merged vertices
+#define LOD_WEIGHT_COST 0.01f       //Cost of a full weight difference, relative to the squared mesh size
+#define LOD_HYSTERESIS 0.15f        //Fraction of a size boundary to go past before the level changes
+
+struct MeshLevel
+{
+	int numVertices;            //The level uses vertices [0, numVertices)
+	int firstIndex, numIndices; //and this range of the compact mesh's indices
+	float error;                //Square root of the largest quadric error of its collapses
+};
+
+struct Quadric
+{
+	double q[10]; //Upper triangle of the symmetric 4x4 matrix: xx xy xz xw yy yz yw zz zw ww
+};
+
+struct Collapse
+{
+	double cost;
+	int u, v;    //u is merged into v
+	int version; //of u when the collapse was found
+
+	bool operator<(const Collapse& c) const { return cost > c.cost; } //The queue pops the cheapest
+};
+
+struct LODSimplifier
+{
+	const aiMesh* mesh;
+	const SkinTable* table;
+	std::vector<unsigned int> tris;             //3 vertices per triangle, updated by the collapses
+	std::vector<char> triRemoved;
+	std::vector< std::vector<int> > vertexTris; //Triangles around each vertex (may list removed ones)
+	std::vector<Quadric> quadrics;
+	std::vector<char> locked, removed;
+	std::vector<int> version;
+	std::priority_queue<Collapse> queue;
+	double weightCost;
+};
+
+// ----------------------------------------------------------------------------
+void addPlane(Quadric* Q, const aiVector3D& n, float d)
+{
+	double p[4] = { n.x, n.y, n.z, d };
+	int k = 0;
+	for (int i = 0; i < 4; i++)
+		for (int j = i; j < 4; j++) Q->q[k++] += p[i] * p[j];
+}
+
+double quadricError(const Quadric& Q, const aiVector3D& v)
+{
+	const double* q = Q.q;
+	double x = v.x, y = v.y, z = v.z;
+	return x * x * q[0] + 2 * x * y * q[1] + 2 * x * z * q[2] + 2 * x * q[3] + y * y * q[4] + 2 * y * z * q[5]
+		+ 2 * y * q[6] + z * z * q[7] + 2 * z * q[8] + q[9];
+}
+
+// Half the summed difference of the bone weights of two vertices (0..1)
+float weightDifference(const SkinTable* table, int a, int b)
+{
+	const unsigned short* ba = &table->bones[a * MAX_INFLUENCES];
+	const unsigned short* bb = &table->bones[b * MAX_INFLUENCES];
+	const float* wa = &table->weights[a * MAX_INFLUENCES];
+	const float* wb = &table->weights[b * MAX_INFLUENCES];
+	float diff = 0;
+	for (int i = 0; i < MAX_INFLUENCES; i++)
+	{
+		if (wa[i] == 0) continue;
+		float other = 0;
+		for (int j = 0; j < MAX_INFLUENCES; j++)
+			if (wb[j] > 0 && bb[j] == ba[i]) other = wb[j];
+		diff += fabs(wa[i] - other);
+	}
+	for (int j = 0; j < MAX_INFLUENCES; j++)
+	{
+		bool shared = false;
+		for (int i = 0; i < MAX_INFLUENCES; i++)
+			if (wa[i] > 0 && ba[i] == bb[j]) shared = true;
+		if (!shared) diff += wb[j];
+	}
+	return diff * 0.5f;
+}
+
+// ----------------------------------------------------------------------------
+// True if moving u onto v would flip or fold one of the triangles around u
+// that remain (the ones without v)
+bool collapseFolds(const LODSimplifier* s, int u, int v)
+{
+	const aiVector3D* pos = s->mesh->mVertices;
+	for (unsigned int k = 0; k < s->vertexTris[u].size(); k++)
+	{
+		int t = s->vertexTris[u][k];
+		if (s->triRemoved[t]) continue;
+		const unsigned int* tri = &s->tris[t * 3];
+		if (tri[0] == (unsigned int)v || tri[1] == (unsigned int)v || tri[2] == (unsigned int)v) continue;
+		int c = tri[0] == (unsigned int)u ? 0 : tri[1] == (unsigned int)u ? 1 : 2;
+		const aiVector3D& a = pos[tri[(c + 1) % 3]];
+		const aiVector3D& b = pos[tri[(c + 2) % 3]];
+		aiVector3D before = (a - pos[u]) ^ (b - pos[u]);
+		aiVector3D after = (a - pos[v]) ^ (b - pos[v]);
+		float la = after.Length(), lb = before.Length();
+		if (la == 0 || before * after < 0.2f * la * lb) return true;
+	}
+	return false;
+}
+
+// Queues the cheapest valid collapse of u into a neighbour, if it has one
+void queueCollapse(LODSimplifier* s, int u)
+{
+	if (s->locked[u] || s->removed[u]) return;
+	const aiVector3D* pos = s->mesh->mVertices;
+	std::vector<Collapse> candidates;
+	for (unsigned int k = 0; k < s->vertexTris[u].size(); k++)
+	{
+		int t = s->vertexTris[u][k];
+		if (s->triRemoved[t]) continue;
+		for (int c = 0; c < 3; c++)
+		{
+			int v = s->tris[t * 3 + c];
+			if (v == u) continue;
+			float wd = weightDifference(s->table, u, v);
+			if (wd > LOD_MAX_WEIGHT_CHANGE) continue;
+			Collapse col = { quadricError(s->quadrics[u], pos[v]) + wd * s->weightCost, u, v, s->version[u] };
+			candidates.push_back(col);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+	for (unsigned int k = 0; k < candidates.size(); k++)
+	{
+		if (collapseFolds(s, u, candidates[k].v)) continue;
+		s->queue.push(candidates[k]);
+		return;
+	}
+}
+
+// Merges u into v and requeues the vertices around v
+void collapseEdge(LODSimplifier* s, int u, int v)
+{
+	s->removed[u] = 1;
+	for (int k = 0; k < 10; k++) s->quadrics[v].q[k] += s->quadrics[u].q[k];
+	std::vector<int> around;
+	for (unsigned int k = 0; k < s->vertexTris[u].size(); k++)
+	{
+		int t = s->vertexTris[u][k];
+		if (s->triRemoved[t]) continue;
+		unsigned int* tri = &s->tris[t * 3];
+		if (tri[0] == (unsigned int)v || tri[1] == (unsigned int)v || tri[2] == (unsigned int)v)
+		{
+			s->triRemoved[t] = 1;
+			continue;
+		}
+		for (int c = 0; c < 3; c++)
+			if (tri[c] == (unsigned int)u) tri[c] = v;
+		s->vertexTris[v].push_back(t);
+	}
+	s->vertexTris[u].clear();
+
+	std::vector<int> live;
+	for (unsigned int k = 0; k < s->vertexTris[v].size(); k++)
+	{
+		int t = s->vertexTris[v][k];
+		if (s->triRemoved[t]) continue;
+		live.push_back(t);
+		for (int c = 0; c < 3; c++) around.push_back(s->tris[t * 3 + c]);
+	}
+	s->vertexTris[v].swap(live);
+	std::sort(around.begin(), around.end());
+	around.erase(std::unique(around.begin(), around.end()), around.end());
+	for (unsigned int k = 0; k < around.size(); k++)
+	{
+		s->version[around[k]]++;
+		queueCollapse(s, around[k]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Seam vertices (a position shared by several vertices) and border vertices
+// (on an edge of a single triangle, or of more than two)
+void lockSeamsAndBorders(LODSimplifier* s)
+{
+	const aiVector3D* pos = s->mesh->mVertices;
+	int numVert = s->mesh->mNumVertices;
+	std::map<std::vector<float>, int> firstAt;
+	for (int i = 0; i < numVert; i++)
+	{
+		std::vector<float> key(&pos[i].x, &pos[i].x + 3);
+		std::map<std::vector<float>, int>::iterator it = firstAt.find(key);
+		if (it == firstAt.end()) firstAt[key] = i;
+		else s->locked[i] = s->locked[it->second] = 1;
+	}
+	std::map<std::pair<unsigned int, unsigned int>, int> edges;
+	for (unsigned int t = 0; t < s->tris.size() / 3; t++)
+		for (int c = 0; c < 3; c++)
+		{
+			unsigned int a = s->tris[t * 3 + c], b = s->tris[t * 3 + (c + 1) % 3];
+			edges[std::make_pair(aisgl_min(a, b), aisgl_max(a, b))]++;
+		}
+	for (std::map<std::pair<unsigned int, unsigned int>, int>::iterator it = edges.begin(); it != edges.end(); ++it)
+		if (it->second != 2) s->locked[it->first.first] = s->locked[it->first.second] = 1;
+}
+
+// ----------------------------------------------------------------------------
+// Reorders the per-vertex arrays of a mesh (and its skin table, faces and
+// bone weights); order[i] is the old index of new vertex i
+template <class T> void permuteVertices(T* array, const std::vector<unsigned int>& order)
+{
+	if (array == NULL) return;
+	std::vector<T> copy(array, array + order.size());
+	for (unsigned int i = 0; i < order.size(); i++) array[i] = copy[order[i]];
+}
+
+void reorderMeshVertices(aiMesh* mesh, SkinTable* table, const std::vector<unsigned int>& order,
+	const std::vector<unsigned int>& newIndex)
+{
+	permuteVertices(mesh->mVertices, order);
+	permuteVertices(mesh->mNormals, order);
+	permuteVertices(mesh->mTangents, order);
+	permuteVertices(mesh->mBitangents, order);
+	for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++) permuteVertices(mesh->mTextureCoords[k], order);
+	for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++) permuteVertices(mesh->mColors[k], order);
+	for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+		for (unsigned int k = 0; k < mesh->mFaces[f].mNumIndices; k++)
+			mesh->mFaces[f].mIndices[k] = newIndex[mesh->mFaces[f].mIndices[k]];
+	for (unsigned int b = 0; b < mesh->mNumBones; b++)
+		for (unsigned int w = 0; w < mesh->mBones[b]->mNumWeights; w++)
+			mesh->mBones[b]->mWeights[w].mVertexId = newIndex[mesh->mBones[b]->mWeights[w].mVertexId];
+
+	std::vector<unsigned short> bones(table->bones);
+	std::vector<float> weights(table->weights);
+	for (unsigned int i = 0; i < order.size(); i++)
+		for (int k = 0; k < MAX_INFLUENCES; k++)
+		{
+			table->bones[i * MAX_INFLUENCES + k] = bones[order[i] * MAX_INFLUENCES + k];
+			table->weights[i * MAX_INFLUENCES + k] = weights[order[i] * MAX_INFLUENCES + k];
+		}
+}
+
+// ----------------------------------------------------------------------------
+// Simplifies a mesh into levels (levels[0] is the full mesh) and reorders its
+// vertices and skin table for them. The triangles of the simplified levels
+// are returned in levelIndices, for addLevelIndices() once the compact mesh
+// is built. Meshes that are not triangle meshes only get level 0.
+void buildMeshLevels(aiMesh* mesh, SkinTable* table, std::vector<MeshLevel>* levels,
+	std::vector< std::vector<unsigned int> >* levelIndices)
+{
+	int numVert = mesh->mNumVertices;
+	MeshLevel full = { numVert, 0, 0, 0 };
+	levels->assign(1, full);
+	levelIndices->assign(1, std::vector<unsigned int>());
+	bool triangles = numVert >= LOD_MIN_VERTICES;
+	for (unsigned int f = 0; f < mesh->mNumFaces && triangles; f++) triangles = mesh->mFaces[f].mNumIndices == 3;
+	if (!triangles) return;
+
+	LODSimplifier s;
+	s.mesh = mesh;
+	s.table = table;
+	s.vertexTris.resize(numVert);
+	s.quadrics.resize(numVert);
+	for (int i = 0; i < numVert; i++) memset(s.quadrics[i].q, 0, sizeof(s.quadrics[i].q));
+	s.locked.assign(numVert, 0);
+	s.removed.assign(numVert, 0);
+	s.version.assign(numVert, 0);
+	aiVector3D min(1e10f, 1e10f, 1e10f), max(-1e10f, -1e10f, -1e10f);
+	for (int i = 0; i < numVert; i++)
+	{
+		const aiVector3D& p = mesh->mVertices[i];
+		min.x = aisgl_min(min.x, p.x); max.x = aisgl_max(max.x, p.x);
+		min.y = aisgl_min(min.y, p.y); max.y = aisgl_max(max.y, p.y);
+		min.z = aisgl_min(min.z, p.z); max.z = aisgl_max(max.z, p.z);
+	}
+	s.weightCost = LOD_WEIGHT_COST * (max - min).SquareLength();
+
+	for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+	{
+		const unsigned int* idx = mesh->mFaces[f].mIndices;
+		if (idx[0] == idx[1] || idx[1] == idx[2] || idx[2] == idx[0]) continue;
+		int t = s.tris.size() / 3;
+		s.tris.insert(s.tris.end(), idx, idx + 3);
+		s.triRemoved.push_back(0);
+		const aiVector3D& a = mesh->mVertices[idx[0]];
+		aiVector3D n = (mesh->mVertices[idx[1]] - a) ^ (mesh->mVertices[idx[2]] - a);
+		if (n.Length() > 0) n.Normalize();
+		for (int c = 0; c < 3; c++)
+		{
+			s.vertexTris[idx[c]].push_back(t);
+			addPlane(&s.quadrics[idx[c]], n, -(n * a));
+		}
+	}
+	lockSeamsAndBorders(&s);
+	for (int i = 0; i < numVert; i++) queueCollapse(&s, i);
+
+	std::vector<unsigned int> removedOrder;
+	double maxCost = 0;
+	int live = numVert;
+	for (int level = 1; level < MAX_LOD_LEVELS; level++)
+	{
+		int target = numVert >> level;
+		while (live > target && !s.queue.empty())
+		{
+			Collapse c = s.queue.top();
+			s.queue.pop();
+			if (s.removed[c.u] || s.removed[c.v] || c.version != s.version[c.u]) continue;
+			collapseEdge(&s, c.u, c.v);
+			removedOrder.push_back(c.u);
+			maxCost = aisgl_max(maxCost, c.cost);
+			live--;
+		}
+		if (live > levels->back().numVertices * 0.9) break; //Stuck: too little left to remove
+		MeshLevel lv = { live, 0, 0, (float)sqrt(maxCost) };
+		levels->push_back(lv);
+		levelIndices->push_back(std::vector<unsigned int>());
+		for (unsigned int t = 0; t < s.triRemoved.size(); t++)
+			if (!s.triRemoved[t]) levelIndices->back().insert(levelIndices->back().end(), &s.tris[t * 3], &s.tris[t * 3 + 3]);
+		if (live > target) break;
+	}
+	if (levels->size() == 1) return;
+
+	//The vertices of the coarsest level, then the removed ones, last removed
+	//first. Collapses made after the coarsest level was taken are left out.
+	removedOrder.resize(numVert - levels->back().numVertices);
+	std::vector<char> dropped(numVert, 0);
+	for (unsigned int k = 0; k < removedOrder.size(); k++) dropped[removedOrder[k]] = 1;
+	std::vector<unsigned int> order, newIndex(numVert);
+	for (int i = 0; i < numVert; i++)
+		if (!dropped[i]) order.push_back(i);
+	for (int k = removedOrder.size() - 1; k >= 0; k--) order.push_back(removedOrder[k]);
+	for (int i = 0; i < numVert; i++) newIndex[order[i]] = i;
+	reorderMeshVertices(mesh, table, order, newIndex);
+	for (unsigned int l = 1; l < levelIndices->size(); l++)
+		for (unsigned int k = 0; k < (*levelIndices)[l].size(); k++) (*levelIndices)[l][k] = newIndex[(*levelIndices)[l][k]];
+}
+
+// ----------------------------------------------------------------------------
+// Appends the triangles of the simplified levels to the compact mesh's
+// indices and completes the index ranges of all levels
+void addLevelIndices(CompactMesh* cm, const std::vector< std::vector<unsigned int> >& levelIndices,
+	std::vector<MeshLevel>* levels)
+{
+	(*levels)[0].firstIndex = 0;
+	(*levels)[0].numIndices = cm->numIndices();
+	for (unsigned int l = 1; l < levels->size(); l++)
+	{
+		const std::vector<unsigned int>& indices = levelIndices[l];
+		(*levels)[l].firstIndex = cm->numIndices();
+		(*levels)[l].numIndices = indices.size();
+		if (cm->indices32.empty()) cm->indices16.insert(cm->indices16.end(), indices.begin(), indices.end());
+		else cm->indices32.insert(cm->indices32.end(), indices.begin(), indices.end());
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Level for a character that covers the given number of pixels on screen:
+// level 0 down to fullPixels, then one level further per halving of the
+// size. The level only changes once the size is LOD_HYSTERESIS past a
+// boundary, so a character near one does not flicker between two levels.
+int selectLevel(int current, float pixels, float fullPixels, int numLevels)
+{
+	current = aisgl_max(0, aisgl_min(current, numLevels - 1));
+	while (current + 1 < numLevels && pixels < fullPixels / (1 << current) * (1 - LOD_HYSTERESIS)) current++;
+	while (current > 0 && pixels > fullPixels / (1 << (current - 1)) * (1 + LOD_HYSTERESIS)) current--;
+	return current;
+}
@@ -0,0 +1,166 @@
+// ----------------------------------------------------------------------------
+// Baked pose cache
+//
+// A clip is sampled at a fixed rate (frames per tick) into one flat array of
+// local channel matrices, indexed by frame and then by channel. Only the top
+// three rows of each matrix are stored. Evaluating the clip at runtime is then
+// a copy of one cached row, or a lerp between two rows for times that fall
+// between frames. The array can be written to disk and memory-mapped on the
+// next start instead of being baked again.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BAKE_FLOATS 12 //Floats per channel matrix
+#define BAKE_MAGIC "POSEBAK1"
+
+struct BakeHeader
+{
+	char magic[8];
+	unsigned int numFrames;
+	unsigned int numChannels;
+	float rate;
+	float duration;
+	long long sourceTime; //Modification time of the file the clip was loaded from
+};
+
+struct BakedClip
+{
+	int numFrames;              //0 if the clip has not been baked
+	int numChannels;
+	float rate;                 //Frames per animation tick
+	const float* frames;        //numFrames * numChannels * BAKE_FLOATS
+	std::vector<float> storage; //Owns the frames when baked in memory
+	void* mapping;              //Owns the frames when mapped from disk
+	size_t mappingSize;
+};
+
+// ----------------------------------------------------------------------------
+long long fileModTime(const char* path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) return 0;
+	return (long long)st.st_mtime;
+}
+
+// ----------------------------------------------------------------------------
+size_t bakedClipBytes(const BakedClip* clip)
+{
+	return (size_t)clip->numFrames * clip->numChannels * BAKE_FLOATS * sizeof(float);
+}
+
+// ----------------------------------------------------------------------------
+void releaseBakedClip(BakedClip* clip)
+{
+	if (clip->mapping != NULL) munmap(clip->mapping, clip->mappingSize);
+	clip->mapping = NULL;
+	clip->mappingSize = 0;
+	clip->storage.clear();
+	clip->frames = NULL;
+	clip->numFrames = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Samples every channel of the clip with sampleChannel(), using private key
+// cursors so that the playback cursors are left untouched.
+void bakeClip(const aiAnimation* anim, float rate, bool stepRotation, BakedClip* clip)
+{
+	releaseBakedClip(clip);
+	clip->numFrames = (int)(anim->mDuration * rate) + 1;
+	clip->numChannels = anim->mNumChannels;
+	clip->rate = rate;
+	clip->storage.resize((size_t)clip->numFrames * clip->numChannels * BAKE_FLOATS);
+
+	std::vector<KeyCursor> cursors(anim->mNumChannels, KeyCursor());
+	float* row = clip->storage.data();
+	for (int f = 0; f < clip->numFrames; f++)
+	{
+		for (int c = 0; c < clip->numChannels; c++, row += BAKE_FLOATS)
+		{
+			aiMatrix4x4 m = sampleChannel(anim->mChannels[c], f / rate, &cursors[c], stepRotation);
+			memcpy(row, &m.a1, BAKE_FLOATS * sizeof(float));
+		}
+	}
+	clip->frames = clip->storage.data();
+}
+
+// ----------------------------------------------------------------------------
+bool saveBakedClip(const BakedClip* clip, const aiAnimation* anim, const char* path, long long sourceTime)
+{
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL) return false;
+	BakeHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BAKE_MAGIC, 8);
+	header.numFrames = clip->numFrames;
+	header.numChannels = clip->numChannels;
+	header.rate = clip->rate;
+	header.duration = anim->mDuration;
+	header.sourceTime = sourceTime;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(clip->frames, bakedClipBytes(clip), 1, fp) == 1;
+	fclose(fp);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Maps a clip saved by saveBakedClip(). Fails if the file is missing or was
+// baked from a different clip, source file or rate.
+bool mapBakedClip(const char* path, const aiAnimation* anim, float rate, long long sourceTime, BakedClip* clip)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(BakeHeader))
+		mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+
+	const BakeHeader* header = (const BakeHeader*)mapping;
+	size_t expected = sizeof(BakeHeader) + (size_t)header->numFrames * header->numChannels * BAKE_FLOATS * sizeof(float);
+	if (memcmp(header->magic, BAKE_MAGIC, 8) != 0 || header->numChannels != anim->mNumChannels
+		|| header->rate != rate || header->duration != (float)anim->mDuration
+		|| header->sourceTime != sourceTime || (size_t)st.st_size != expected)
+	{
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	releaseBakedClip(clip);
+	clip->numFrames = header->numFrames;
+	clip->numChannels = header->numChannels;
+	clip->rate = rate;
+	clip->frames = (const float*)(header + 1);
+	clip->mapping = mapping;
+	clip->mappingSize = st.st_size;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Local matrix of a channel at the given tick. Ticks that fall on a frame are
+// copied, others are lerped element-wise between the two nearest frames.
+aiMatrix4x4 sampleBakedClip(const BakedClip* clip, int channel, double tick)
+{
+	aiMatrix4x4 m;
+	float f = tick * clip->rate;
+	f = aisgl_max(0.0f, aisgl_min(f, (float)(clip->numFrames - 1)));
+	int f0 = (int)f;
+	float a = f - f0;
+	const float* row0 = clip->frames + ((size_t)f0 * clip->numChannels + channel) * BAKE_FLOATS;
+	if (a == 0 || f0 + 1 >= clip->numFrames)
+		memcpy(&m.a1, row0, BAKE_FLOATS * sizeof(float));
+	else
+	{
+		const float* row1 = row0 + clip->numChannels * BAKE_FLOATS;
+		float* out = &m.a1;
+		for (int e = 0; e < BAKE_FLOATS; e++) out[e] = row0[e] + (row1[e] - row0[e]) * a;
+	}
+	return m;
+}
@@ -0,0 +1,291 @@
+// ----------------------------------------------------------------------------
+// Frame profiler
+//
+// Scoped timers (PROFILE_SCOPE) and per-frame counters (PROFILE_COUNT) for
+// the hot paths. They compile to nothing unless ENABLE_PROFILER is defined
+// (PROFILE=1 ./build_and_run.sh defines it for the viewer). Timed scopes are
+// collected from every thread; profileEndFrame() closes a frame, adds it to
+// a short history for the on-screen overlay and, while recording, keeps its
+// events for export as a Chrome trace (chrome://tracing, Perfetto) and its
+// totals as one CSV row per frame. Allocations are counted by replacing the
+// global operator new; those made by the profiler itself are not counted.
+//-----------------------------------------------------------------------------
+
+#ifdef ENABLE_PROFILER
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <cstring>
+
+#define PROFILE_HISTORY 60       //Frames averaged by the overlay
+#define PROFILE_MAX_EVENTS 1000000 //Events kept while recording
+
+enum ProfileCounter { PROFILE_VERTICES, PROFILE_DRAW_CALLS, PROFILE_STATE_CHANGES, PROFILE_ALLOCATIONS, NUM_PROFILE_COUNTERS };
+const char* profileCounterNames[NUM_PROFILE_COUNTERS] = { "vertices skinned (CPU)", "draw calls", "material state changes",
+	"allocations" };
+
+struct ProfileEvent
+{
+	const char* name; //Static string
+	long long start;  //Nanoseconds since the profiler started
+	long long duration;
+	int thread;
+};
+
+struct ProfileFrame
+{
+	long long start, duration;
+	std::vector<std::pair<const char*, long long> > scopes; //Total time per scope name, in first-seen order
+	long counters[NUM_PROFILE_COUNTERS];
+};
+
+struct Profiler
+{
+	std::mutex lock;
+	std::chrono::steady_clock::time_point epoch;
+	std::vector<ProfileEvent> events;  //Current frame
+	std::vector<ProfileFrame> history; //Ring of the last PROFILE_HISTORY frames
+	int numFrames;
+	long long frameStart;
+	bool recording;
+	std::vector<ProfileEvent> trace;   //Recorded events
+	std::vector<ProfileFrame> frames;  //Recorded frames
+
+	Profiler() : epoch(std::chrono::steady_clock::now()), numFrames(0), frameStart(0), recording(false) {}
+};
+
+Profiler profiler;
+std::atomic<long> profileCounters[NUM_PROFILE_COUNTERS];
+std::atomic<int> profileNumThreads(0);
+thread_local int profileThread = -1;
+thread_local int profileSuspended = 0; //Allocations of this thread are not counted while > 0
+
+// Suspends allocation counting on this thread while the profiler records
+struct ProfileSuspend
+{
+	ProfileSuspend() { profileSuspended++; }
+	~ProfileSuspend() { profileSuspended--; }
+};
+
+// ----------------------------------------------------------------------------
+long long profileNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profiler.epoch).count();
+}
+
+struct ProfileScope
+{
+	const char* name;
+	long long start;
+
+	ProfileScope(const char* scopeName) : name(scopeName), start(profileNow()) {}
+	~ProfileScope()
+	{
+		ProfileEvent e = { name, start, profileNow() - start, profileThread };
+		if (e.thread < 0) e.thread = profileThread = profileNumThreads++;
+		ProfileSuspend suspend;
+		std::lock_guard<std::mutex> lock(profiler.lock);
+		profiler.events.push_back(e);
+	}
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) (profileCounters[counter] += (n))
+#define PROFILE_FRAME() profileEndFrame()
+
+// ----------------------------------------------------------------------------
+// Counted replacements of the global allocation functions (the array and
+// sized forms forward to these)
+void* operator new(size_t size)
+{
+	if (profileSuspended == 0) profileCounters[PROFILE_ALLOCATIONS]++;
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// ----------------------------------------------------------------------------
+// Closes the current frame: totals its events per scope name and resets the
+// counters
+void profileEndFrame()
+{
+	ProfileSuspend suspend;
+	long long now = profileNow();
+	ProfileFrame frame;
+	frame.start = profiler.frameStart;
+	frame.duration = now - profiler.frameStart;
+	for (int c = 0; c < NUM_PROFILE_COUNTERS; c++) frame.counters[c] = profileCounters[c].exchange(0);
+	profiler.frameStart = now;
+
+	std::lock_guard<std::mutex> lock(profiler.lock);
+	for (unsigned int i = 0; i < profiler.events.size(); i++)
+	{
+		const ProfileEvent& e = profiler.events[i];
+		unsigned int k = 0;
+		while (k < frame.scopes.size() && strcmp(frame.scopes[k].first, e.name) != 0) k++;
+		if (k == frame.scopes.size()) frame.scopes.push_back(std::make_pair(e.name, 0LL));
+		frame.scopes[k].second += e.duration;
+	}
+	if (profiler.recording)
+	{
+		if (profiler.trace.size() + profiler.events.size() <= PROFILE_MAX_EVENTS)
+			profiler.trace.insert(profiler.trace.end(), profiler.events.begin(), profiler.events.end());
+		profiler.frames.push_back(frame);
+	}
+	profiler.events.clear();
+	if (profiler.history.size() < PROFILE_HISTORY) profiler.history.push_back(frame);
+	else profiler.history[profiler.numFrames % PROFILE_HISTORY] = frame;
+	profiler.numFrames++;
+}
+
+// ----------------------------------------------------------------------------
+// Lines of the overlay: frame time and the time of every scope (milliseconds)
+// and the counters, averaged over the history
+std::vector<std::string> profileSummary()
+{
+	ProfileSuspend suspend;
+	std::vector<std::pair<const char*, long long> > scopes;
+	long long frameTime = 0;
+	double counters[NUM_PROFILE_COUNTERS] = { 0 };
+	int n = profiler.history.size();
+	for (int f = 0; f < n; f++)
+	{
+		const ProfileFrame& frame = profiler.history[f];
+		frameTime += frame.duration;
+		for (int c = 0; c < NUM_PROFILE_COUNTERS; c++) counters[c] += frame.counters[c];
+		for (unsigned int i = 0; i < frame.scopes.size(); i++)
+		{
+			unsigned int k = 0;
+			while (k < scopes.size() && strcmp(scopes[k].first, frame.scopes[i].first) != 0) k++;
+			if (k == scopes.size()) scopes.push_back(std::make_pair(frame.scopes[i].first, 0LL));
+			scopes[k].second += frame.scopes[i].second;
+		}
+	}
+	std::vector<std::string> lines;
+	if (n == 0) return lines;
+	char line[128];
+	snprintf(line, sizeof(line), "frame %.2f ms (%.0f fps)%s", frameTime / 1e6 / n, n * 1e9 / aisgl_max(frameTime, 1LL),
+		profiler.recording ? "  [recording]" : "");
+	lines.push_back(line);
+	for (unsigned int k = 0; k < scopes.size(); k++)
+	{
+		snprintf(line, sizeof(line), "  %-22s %8.3f ms", scopes[k].first, scopes[k].second / 1e6 / n);
+		lines.push_back(line);
+	}
+	for (int c = 0; c < NUM_PROFILE_COUNTERS; c++)
+	{
+		snprintf(line, sizeof(line), "  %-22s %8.0f", profileCounterNames[c], counters[c] / n);
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+// ----------------------------------------------------------------------------
+// Recorded events as Chrome trace-event JSON ("X" events in microseconds,
+// plus one counter event per frame)
+bool writeChromeTrace(const char* path)
+{
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL) return false;
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (unsigned int i = 0; i < profiler.trace.size(); i++)
+	{
+		const ProfileEvent& e = profiler.trace[i];
+		fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d},\n",
+			e.name, e.start / 1e3, e.duration / 1e3, e.thread);
+	}
+	for (unsigned int f = 0; f < profiler.frames.size(); f++)
+	{
+		const ProfileFrame& frame = profiler.frames[f];
+		fprintf(fp, "{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", frame.start / 1e3);
+		for (int c = 0; c < NUM_PROFILE_COUNTERS; c++)
+			fprintf(fp, "\"%s\":%ld%s", profileCounterNames[c], frame.counters[c], c + 1 < NUM_PROFILE_COUNTERS ? "," : "");
+		fprintf(fp, "}},\n");
+	}
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Model Loader\"}}\n]}\n");
+	return fclose(fp) == 0;
+}
+
+// ----------------------------------------------------------------------------
+// One row per recorded frame: frame time, the time of every scope seen
+// (milliseconds) and the counters
+bool writeProfileCSV(const char* path)
+{
+	std::vector<const char*> names;
+	for (unsigned int f = 0; f < profiler.frames.size(); f++)
+		for (unsigned int i = 0; i < profiler.frames[f].scopes.size(); i++)
+		{
+			unsigned int k = 0;
+			while (k < names.size() && strcmp(names[k], profiler.frames[f].scopes[i].first) != 0) k++;
+			if (k == names.size()) names.push_back(profiler.frames[f].scopes[i].first);
+		}
+
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL) return false;
+	fprintf(fp, "frame,frame_ms");
+	for (unsigned int k = 0; k < names.size(); k++) fprintf(fp, ",%s_ms", names[k]);
+	for (int c = 0; c < NUM_PROFILE_COUNTERS; c++) fprintf(fp, ",%s", profileCounterNames[c]);
+	fprintf(fp, "\n");
+	for (unsigned int f = 0; f < profiler.frames.size(); f++)
+	{
+		const ProfileFrame& frame = profiler.frames[f];
+		fprintf(fp, "%u,%.4f", f, frame.duration / 1e6);
+		for (unsigned int k = 0; k < names.size(); k++)
+		{
+			long long t = 0;
+			for (unsigned int i = 0; i < frame.scopes.size(); i++)
+				if (strcmp(frame.scopes[i].first, names[k]) == 0) t = frame.scopes[i].second;
+			fprintf(fp, ",%.4f", t / 1e6);
+		}
+		for (int c = 0; c < NUM_PROFILE_COUNTERS; c++) fprintf(fp, ",%ld", frame.counters[c]);
+		fprintf(fp, "\n");
+	}
+	return fclose(fp) == 0;
+}
+
+// ----------------------------------------------------------------------------
+// Starts recording, or stops and writes <prefix>.json and <prefix>.csv
+void toggleProfileRecording(const char* prefix)
+{
+	ProfileSuspend suspend;
+	if (profiler.recording) profileEndFrame(); //Events since the last frame
+	std::lock_guard<std::mutex> lock(profiler.lock);
+	profiler.recording = !profiler.recording;
+	if (profiler.recording)
+	{
+		profiler.trace.clear();
+		profiler.frames.clear();
+		cout << "Profiler recording" << endl;
+		return;
+	}
+	std::string json = std::string(prefix) + ".json", csv = std::string(prefix) + ".csv";
+	bool ok = writeChromeTrace(json.c_str()) && writeProfileCSV(csv.c_str());
+	cout << (ok ? "Profile written to " : "Couldn't write profile ") << json << ", " << csv << " ("
+		<< profiler.frames.size() << " frames)" << endl;
+}
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_FRAME()
+
+#endif
@@ -0,0 +1,158 @@
+// ----------------------------------------------------------------------------
+// Animation retargeting
+//
+// A clip made for another skeleton (the BVH walk played on the dwarf) is
+// mapped onto the channels of the character's own clip once at load time.
+// Joints are paired by name: names are compared case-insensitively with
+// namespace prefixes and separators removed, and common limb names are
+// reduced to one canonical part with its side ("LeftUpLeg", "lThigh" and
+// "lhip" are all the left upper leg). An optional override file
+// "<model file>.retarget" then adjusts the pairs, one directive per line:
+//
+//     <target joint> <source joint>   map the joint
+//     <target joint> -                leave the joint to the character's clip
+//     clear                           drop the pairs matched by name
+//     pin <target joint>              keep the joint at its first position key
+//
+// Mapped joints take their rotation from the source clip and keep their own
+// translation. The result is a flat array indexed by target channel, so a
+// frame of a foreign clip costs one lookup per channel.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+struct RetargetMap
+{
+	std::vector<int> sourceChannel; //Per target channel: channel of the source clip, -1 if not mapped
+	int pinnedChannel;              //Target channel kept at its first position key, -1 for none
+	aiVector3D pinnedPosition;      //and that key
+	int numMapped;
+
+	RetargetMap() : pinnedChannel(-1), numMapped(0) {}
+};
+
+// Limb name synonyms and the canonical part they stand for
+const char* retargetSynonyms[][2] = {
+	{ "upleg", "upperleg" }, { "thigh", "upperleg" }, { "hip", "upperleg" },
+	{ "leg", "lowerleg" }, { "shin", "lowerleg" }, { "calf", "lowerleg" }, { "knee", "lowerleg" },
+	{ "ankle", "foot" }, { "toebase", "toe" },
+	{ "shldr", "upperarm" }, { "shoulder", "upperarm" }, { "sholda", "upperarm" }, { "arm", "upperarm" },
+	{ "elbow", "forearm" }, { "elbo", "forearm" }, { "lowerarm", "forearm" },
+	{ "wrist", "hand" }, { "clavicle", "collar" }
+};
+
+// ----------------------------------------------------------------------------
+// Lower-case alphanumerics of the name after the last ':' (mixamorig:Hips -> hips)
+std::string plainJointName(const char* name)
+{
+	const char* colon = strrchr(name, ':');
+	if (colon != NULL) name = colon + 1;
+	std::string plain;
+	for (; *name; name++)
+		if (isalnum((unsigned char)*name)) plain += tolower((unsigned char)*name);
+	return plain;
+}
+
+// ----------------------------------------------------------------------------
+// Canonical limb part of a plain name without its side, "" if not a limb
+std::string canonicalLimb(const std::string& part)
+{
+	const char* limbs[] = { "upperleg", "lowerleg", "foot", "toe", "collar", "upperarm", "forearm", "hand" };
+	for (unsigned int k = 0; k < sizeof(retargetSynonyms) / sizeof(retargetSynonyms[0]); k++)
+		if (part == retargetSynonyms[k][0]) return retargetSynonyms[k][1];
+	for (unsigned int k = 0; k < sizeof(limbs) / sizeof(limbs[0]); k++)
+		if (part == limbs[k]) return part;
+	return "";
+}
+
+// ----------------------------------------------------------------------------
+// Side and body part of a joint name: "lThigh" -> "l.upperleg", "Head" -> "head"
+std::string canonicalJointName(const char* name)
+{
+	std::string plain = plainJointName(name);
+	const char* sides[][2] = { { "left", "l" }, { "right", "r" }, { "l", "l" }, { "r", "r" } };
+	for (int s = 0; s < 4; s++)
+	{
+		size_t n = strlen(sides[s][0]);
+		if (plain.compare(0, n, sides[s][0]) != 0) continue;
+		std::string limb = canonicalLimb(plain.substr(n));
+		if (!limb.empty()) return std::string(sides[s][1]) + "." + limb;
+	}
+	return plain;
+}
+
+// ----------------------------------------------------------------------------
+int findChannel(const aiAnimation* anim, const std::string& name)
+{
+	for (unsigned int i = 0; i < anim->mNumChannels; i++)
+		if (plainJointName(anim->mChannels[i]->mNodeName.C_Str()) == plainJointName(name.c_str())) return i;
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+// Applies the directives of an override file. Returns false if the file
+// can't be opened (it is optional); unknown joints are reported and skipped.
+bool readRetargetOverrides(const char* path, const aiAnimation* target, const aiAnimation* source, RetargetMap* map)
+{
+	std::ifstream in(path);
+	if (!in) return false;
+	std::string line;
+	for (int lineNo = 1; std::getline(in, line); lineNo++)
+	{
+		size_t hash = line.find('#');
+		if (hash != std::string::npos) line.erase(hash);
+		std::istringstream words(line);
+		std::string first, second;
+		if (!(words >> first)) continue;
+		words >> second;
+		if (first == "clear")
+		{
+			map->sourceChannel.assign(target->mNumChannels, -1);
+			continue;
+		}
+		if (first == "pin")
+		{
+			map->pinnedChannel = findChannel(target, second);
+			if (map->pinnedChannel < 0) cout << path << ":" << lineNo << ": no joint " << second << endl;
+			continue;
+		}
+		int t = findChannel(target, first);
+		int s = (second == "-") ? -1 : findChannel(source, second);
+		if (t < 0 || (s < 0 && second != "-"))
+		{
+			cout << path << ":" << lineNo << ": no joint " << (t < 0 ? first : second) << endl;
+			continue;
+		}
+		map->sourceChannel[t] = s;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Maps the channels of source onto those of target (the character's own clip)
+void buildRetargetMap(const aiAnimation* target, const aiAnimation* source, const char* overrideFile, RetargetMap* map)
+{
+	std::vector<std::string> sourceNames(source->mNumChannels);
+	for (unsigned int s = 0; s < source->mNumChannels; s++)
+		sourceNames[s] = canonicalJointName(source->mChannels[s]->mNodeName.C_Str());
+
+	map->sourceChannel.assign(target->mNumChannels, -1);
+	map->pinnedChannel = -1;
+	for (unsigned int t = 0; t < target->mNumChannels; t++)
+	{
+		std::string name = canonicalJointName(target->mChannels[t]->mNodeName.C_Str());
+		for (unsigned int s = 0; s < source->mNumChannels && map->sourceChannel[t] < 0; s++)
+			if (sourceNames[s] == name) map->sourceChannel[t] = s;
+	}
+	if (overrideFile != NULL) readRetargetOverrides(overrideFile, target, source, map);
+
+	map->numMapped = 0;
+	for (unsigned int t = 0; t < target->mNumChannels; t++)
+		if (map->sourceChannel[t] >= 0) map->numMapped++;
+	if (map->pinnedChannel >= 0 && target->mChannels[map->pinnedChannel]->mNumPositionKeys > 0)
+		map->pinnedPosition = target->mChannels[map->pinnedChannel]->mPositionKeys[0].mValue;
+}
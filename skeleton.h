@@ -0,0 +1,96 @@
+// ----------------------------------------------------------------------------
+// Flattened skeleton
+//
+// The node tree of a scene is stored as arrays in topological order (every
+// parent precedes its children), with bone->node and channel->node indices
+// resolved once at load time. Each frame the global transforms are computed
+// with a single linear pass that is shared by all meshes of the scene.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+
+struct Skeleton
+{
+	int numNodes;
+	std::vector<aiNode*> nodes;                      //Scene nodes in topological order
+	std::vector<int> parent;                         //Parent node index, -1 for the root
+	std::vector<aiMatrix4x4> global;                 //Global transforms of the current pose
+	std::vector< std::vector<int> > boneNode;        //Per mesh: bone index -> node index
+	std::vector< std::vector<aiMatrix4x4> > palette; //Per mesh: bone index -> global * offset matrix
+};
+
+// ----------------------------------------------------------------------------
+int findSkeletonNode(const Skeleton* skel, const aiString& name)
+{
+	for (int i = 0; i < skel->numNodes; i++)
+		if (skel->nodes[i]->mName == name) return i;
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+void buildSkeleton(const aiScene* scene, Skeleton* skel)
+{
+	skel->nodes.clear();
+	skel->parent.clear();
+
+	//Breadth-first traversal: a node is always appended after its parent
+	skel->nodes.push_back(scene->mRootNode);
+	skel->parent.push_back(-1);
+	for (unsigned int i = 0; i < skel->nodes.size(); i++)
+	{
+		aiNode* nd = skel->nodes[i];
+		for (unsigned int c = 0; c < nd->mNumChildren; c++)
+		{
+			skel->nodes.push_back(nd->mChildren[c]);
+			skel->parent.push_back(i);
+		}
+	}
+	skel->numNodes = skel->nodes.size();
+	skel->global.assign(skel->numNodes, aiMatrix4x4());
+
+	skel->boneNode.assign(scene->mNumMeshes, std::vector<int>());
+	skel->palette.assign(scene->mNumMeshes, std::vector<aiMatrix4x4>());
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+		skel->boneNode[m].resize(mesh->mNumBones);
+		skel->palette[m].resize(mesh->mNumBones);
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
+			skel->boneNode[m][b] = findSkeletonNode(skel, mesh->mBones[b]->mName);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Maps every channel of an animation to the skeleton node it drives (-1 if the
+// node does not exist in this skeleton).
+void resolveChannels(const Skeleton* skel, const aiAnimation* anim, std::vector<int>* channelNode)
+{
+	channelNode->resize(anim->mNumChannels);
+	for (unsigned int i = 0; i < anim->mNumChannels; i++)
+		(*channelNode)[i] = findSkeletonNode(skel, anim->mChannels[i]->mNodeName);
+}
+
+// ----------------------------------------------------------------------------
+void computeGlobalTransforms(Skeleton* skel)
+{
+	skel->global[0] = skel->nodes[0]->mTransformation;
+	for (int i = 1; i < skel->numNodes; i++)
+		skel->global[i] = skel->global[skel->parent[i]] * skel->nodes[i]->mTransformation;
+}
+
+// ----------------------------------------------------------------------------
+// Bone matrices (global transform * offset matrix) of every mesh. Requires
+// computeGlobalTransforms() to have been called for the current pose.
+void updateBonePalettes(const aiScene* scene, Skeleton* skel)
+{
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
+		{
+			int nd = skel->boneNode[m][b];
+			if (nd < 0) skel->palette[m][b] = mesh->mBones[b]->mOffsetMatrix;
+			else skel->palette[m][b] = skel->global[nd] * mesh->mBones[b]->mOffsetMatrix;
+		}
+	}
+}
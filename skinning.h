@@ -0,0 +1,331 @@
+// ----------------------------------------------------------------------------
+// Linear blend skinning
+//
+// The bone weights of a mesh (aiBone::mWeights, stored per bone) are converted
+// once at load time into a per-vertex table of at most MAX_INFLUENCES
+// (bone index, weight) pairs, normalized to sum to 1. Skinning then gathers
+// from the mesh's bone palette and allocates nothing per frame. The bind pose
+// is read in its quantized form (see compact_mesh.h) and decoded on the fly.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SKINNING_X86 1
+#endif
+
+#define MAX_INFLUENCES 4
+
+enum SkinningKernel { SKIN_SCALAR, SKIN_SSE41, SKIN_AVX2, NUM_SKIN_KERNELS };
+const char* skinningKernelNames[NUM_SKIN_KERNELS] = { "scalar", "sse4.1", "avx2" };
+
+#define SKIN_CHUNK_SIZE 2048 //Vertices per skinning task (a multiple of the SIMD batch size)
+
+struct SkinTable
+{
+	int numVertices;
+	std::vector<unsigned short> bones; //numVertices * MAX_INFLUENCES bone indices
+	std::vector<float> weights;        //numVertices * MAX_INFLUENCES weights (0 for unused slots)
+};
+
+// A range of vertices of one mesh, the unit of work for parallel skinning.
+// Chunks depend only on the meshes, never on the thread count, so every
+// vertex is always processed by the same kernel code path.
+struct SkinChunk
+{
+	int mesh;
+	int begin, end;
+};
+
+// ----------------------------------------------------------------------------
+// Keeps the MAX_INFLUENCES largest weights of every vertex. Vertices that are
+// not influenced by any bone get all-zero weights and keep their bind pose.
+void buildSkinTable(const aiMesh* mesh, SkinTable* table)
+{
+	int numVert = mesh->mNumVertices;
+	table->numVertices = numVert;
+	table->bones.assign(numVert * MAX_INFLUENCES, 0);
+	table->weights.assign(numVert * MAX_INFLUENCES, 0.0f);
+
+	for (unsigned int b = 0; b < mesh->mNumBones; b++)
+	{
+		const aiBone* bone = mesh->mBones[b];
+		for (unsigned int w = 0; w < bone->mNumWeights; w++)
+		{
+			int vid = bone->mWeights[w].mVertexId;
+			float weight = bone->mWeights[w].mWeight;
+			unsigned short* bi = &table->bones[vid * MAX_INFLUENCES];
+			float* wi = &table->weights[vid * MAX_INFLUENCES];
+
+			int smallest = 0;
+			for (int k = 1; k < MAX_INFLUENCES; k++)
+				if (wi[k] < wi[smallest]) smallest = k;
+			if (weight > wi[smallest])
+			{
+				bi[smallest] = b;
+				wi[smallest] = weight;
+			}
+		}
+	}
+
+	for (int i = 0; i < numVert; i++)
+	{
+		float* wi = &table->weights[i * MAX_INFLUENCES];
+		float sum = 0;
+		for (int k = 0; k < MAX_INFLUENCES; k++) sum += wi[k];
+		if (sum > 0)
+			for (int k = 0; k < MAX_INFLUENCES; k++) wi[k] /= sum;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Skins vertices [begin, end) of a mesh. Positions are transformed by the
+// blended bone matrix and normals by its upper 3x3 part (GL_NORMALIZE takes
+// care of the length).
+void skinVerticesScalar(const SkinTable* table, const aiMatrix4x4* palette, const CompactMesh* bind,
+	aiVector3D* outVerts, aiVector3D* outNormals, int begin, int end)
+{
+	for (int i = begin; i < end; i++)
+	{
+		const unsigned short* bi = &table->bones[i * MAX_INFLUENCES];
+		const float* wi = &table->weights[i * MAX_INFLUENCES];
+		const aiVector3D v = decodePosition(bind, i);
+		const aiVector3D n = decodeNormal(bind, i);
+
+		if (wi[0] == 0)
+		{
+			outVerts[i] = v;
+			outNormals[i] = n;
+			continue;
+		}
+
+		float m[12] = { 0 }; //Top three rows of the blended bone matrix
+		for (int k = 0; k < MAX_INFLUENCES; k++)
+		{
+			float w = wi[k];
+			if (w == 0) continue;
+			const float* p = &palette[bi[k]].a1;
+			for (int e = 0; e < 12; e++) m[e] += p[e] * w;
+		}
+
+		outVerts[i].x = m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3];
+		outVerts[i].y = m[4] * v.x + m[5] * v.y + m[6] * v.z + m[7];
+		outVerts[i].z = m[8] * v.x + m[9] * v.y + m[10] * v.z + m[11];
+		outNormals[i].x = m[0] * n.x + m[1] * n.y + m[2] * n.z;
+		outNormals[i].y = m[4] * n.x + m[5] * n.y + m[6] * n.z;
+		outNormals[i].z = m[8] * n.x + m[9] * n.y + m[10] * n.z;
+	}
+}
+
+#ifdef SKINNING_X86
+// ----------------------------------------------------------------------------
+// SIMD kernels. Bone matrices are blended per vertex (one row per register),
+// then transposed so that a batch of vertices is transformed in SoA form:
+// x' = m00*X + m01*Y + m02*Z + m03 for 4 (SSE) or 8 (AVX2) vertices at once.
+// Any remainder of the range is finished by the scalar kernel.
+//-----------------------------------------------------------------------------
+
+// Top three rows of the blended bone matrix of vertex i
+__attribute__((target("sse4.1")))
+inline void blendRowsSSE(const SkinTable* table, const aiMatrix4x4* palette, int i,
+	__m128* r0, __m128* r1, __m128* r2)
+{
+	const unsigned short* bi = &table->bones[i * MAX_INFLUENCES];
+	const float* wi = &table->weights[i * MAX_INFLUENCES];
+	if (wi[0] == 0)
+	{
+		*r0 = _mm_setr_ps(1, 0, 0, 0);
+		*r1 = _mm_setr_ps(0, 1, 0, 0);
+		*r2 = _mm_setr_ps(0, 0, 1, 0);
+		return;
+	}
+	__m128 a = _mm_setzero_ps(), b = _mm_setzero_ps(), c = _mm_setzero_ps();
+	for (int k = 0; k < MAX_INFLUENCES; k++)
+	{
+		const float* p = &palette[bi[k]].a1;
+		__m128 w = _mm_set1_ps(wi[k]);
+		a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(p), w));
+		b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(p + 4), w));
+		c = _mm_add_ps(c, _mm_mul_ps(_mm_loadu_ps(p + 8), w));
+	}
+	*r0 = a; *r1 = b; *r2 = c;
+}
+
+// Bind positions and normals of vertices i..i+3, decoded to X, Y, Z (same
+// arithmetic as decodePosition() and octDecode())
+__attribute__((target("sse4.1")))
+inline void loadCompactSoA4(const CompactMesh* bind, int i, __m128* x, __m128* y, __m128* z,
+	__m128* nx, __m128* ny, __m128* nz)
+{
+	const __m128i* q = (const __m128i*)&bind->positions[i * 4];
+	__m128i a = _mm_loadu_si128(q), b = _mm_loadu_si128(q + 1); //x0 y0 z0 - x1 y1 z1 - | x2 ...
+	__m128 p0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(a));
+	__m128 p1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(a, 8)));
+	__m128 p2 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(b));
+	__m128 p3 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(b, 8)));
+	_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+	*x = _mm_add_ps(_mm_set1_ps(bind->posMin.x), _mm_mul_ps(p0, _mm_set1_ps(bind->posStep.x)));
+	*y = _mm_add_ps(_mm_set1_ps(bind->posMin.y), _mm_mul_ps(p1, _mm_set1_ps(bind->posStep.y)));
+	*z = _mm_add_ps(_mm_set1_ps(bind->posMin.z), _mm_mul_ps(p2, _mm_set1_ps(bind->posStep.z)));
+
+	__m128i e = _mm_loadu_si128((const __m128i*)&bind->normals[i * 2]); //u0 v0 u1 v1 u2 v2 u3 v3
+	__m128 lo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(e));
+	__m128 hi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(e, 8)));
+	__m128 scale = _mm_set1_ps(1 / 32767.0f), zero = _mm_setzero_ps();
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 u = _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), scale);
+	__m128 v = _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)), scale);
+	__m128 w = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1), _mm_and_ps(u, absMask)), _mm_and_ps(v, absMask));
+	__m128 t = _mm_max_ps(_mm_sub_ps(zero, w), zero);
+	__m128 negT = _mm_sub_ps(zero, t);
+	*nx = _mm_add_ps(u, _mm_blendv_ps(t, negT, _mm_cmpge_ps(u, zero)));
+	*ny = _mm_add_ps(v, _mm_blendv_ps(t, negT, _mm_cmpge_ps(v, zero)));
+	*nz = w;
+}
+
+// X, Y, Z -> four packed aiVector3D
+__attribute__((target("sse4.1")))
+inline void storeSoA4(aiVector3D* v, __m128 x, __m128 y, __m128 z)
+{
+	float* f = &v[0].x;
+	__m128 xy0 = _mm_unpacklo_ps(x, y); //x0 y0 x1 y1
+	__m128 xy2 = _mm_unpackhi_ps(x, y); //x2 y2 x3 y3
+	_mm_storeu_ps(f, _mm_shuffle_ps(xy0, _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0)));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy2, _MM_SHUFFLE(1, 0, 2, 0)));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, xy2, _MM_SHUFFLE(2, 2, 2, 2)),
+		_mm_shuffle_ps(xy2, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+__attribute__((target("sse4.1")))
+void skinVerticesSSE41(const SkinTable* table, const aiMatrix4x4* palette, const CompactMesh* bind,
+	aiVector3D* outVerts, aiVector3D* outNormals, int begin, int end)
+{
+	int i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 r0[4], r1[4], r2[4];
+		for (int j = 0; j < 4; j++) blendRowsSSE(table, palette, i + j, &r0[j], &r1[j], &r2[j]);
+		_MM_TRANSPOSE4_PS(r0[0], r0[1], r0[2], r0[3]); //r0[e] = element (0,e) of the 4 vertices
+		_MM_TRANSPOSE4_PS(r1[0], r1[1], r1[2], r1[3]);
+		_MM_TRANSPOSE4_PS(r2[0], r2[1], r2[2], r2[3]);
+
+		__m128 x, y, z, nx, ny, nz;
+		loadCompactSoA4(bind, i, &x, &y, &z, &nx, &ny, &nz);
+		storeSoA4(outVerts + i,
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(r0[0], x), _mm_mul_ps(r0[1], y)), _mm_add_ps(_mm_mul_ps(r0[2], z), r0[3])),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(r1[0], x), _mm_mul_ps(r1[1], y)), _mm_add_ps(_mm_mul_ps(r1[2], z), r1[3])),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(r2[0], x), _mm_mul_ps(r2[1], y)), _mm_add_ps(_mm_mul_ps(r2[2], z), r2[3])));
+
+		storeSoA4(outNormals + i,
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(r0[0], nx), _mm_mul_ps(r0[1], ny)), _mm_mul_ps(r0[2], nz)),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(r1[0], nx), _mm_mul_ps(r1[1], ny)), _mm_mul_ps(r1[2], nz)),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(r2[0], nx), _mm_mul_ps(r2[1], ny)), _mm_mul_ps(r2[2], nz)));
+	}
+	skinVerticesScalar(table, palette, bind, outVerts, outNormals, i, end);
+}
+
+__attribute__((target("avx2,fma")))
+void skinVerticesAVX2(const SkinTable* table, const aiMatrix4x4* palette, const CompactMesh* bind,
+	aiVector3D* outVerts, aiVector3D* outNormals, int begin, int end)
+{
+	int i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m128 r0[8], r1[8], r2[8];
+		for (int j = 0; j < 8; j++) blendRowsSSE(table, palette, i + j, &r0[j], &r1[j], &r2[j]);
+		_MM_TRANSPOSE4_PS(r0[0], r0[1], r0[2], r0[3]);
+		_MM_TRANSPOSE4_PS(r0[4], r0[5], r0[6], r0[7]);
+		_MM_TRANSPOSE4_PS(r1[0], r1[1], r1[2], r1[3]);
+		_MM_TRANSPOSE4_PS(r1[4], r1[5], r1[6], r1[7]);
+		_MM_TRANSPOSE4_PS(r2[0], r2[1], r2[2], r2[3]);
+		_MM_TRANSPOSE4_PS(r2[4], r2[5], r2[6], r2[7]);
+
+		__m256 m[12]; //Element (row, col) of the 8 blended matrices at m[row*4 + col]
+		for (int e = 0; e < 4; e++)
+		{
+			m[e] = _mm256_set_m128(r0[e + 4], r0[e]);
+			m[4 + e] = _mm256_set_m128(r1[e + 4], r1[e]);
+			m[8 + e] = _mm256_set_m128(r2[e + 4], r2[e]);
+		}
+
+		__m128 xl, yl, zl, xh, yh, zh, nxl, nyl, nzl, nxh, nyh, nzh;
+		loadCompactSoA4(bind, i, &xl, &yl, &zl, &nxl, &nyl, &nzl);
+		loadCompactSoA4(bind, i + 4, &xh, &yh, &zh, &nxh, &nyh, &nzh);
+		__m256 x = _mm256_set_m128(xh, xl), y = _mm256_set_m128(yh, yl), z = _mm256_set_m128(zh, zl);
+		__m256 ox = _mm256_fmadd_ps(m[0], x, _mm256_fmadd_ps(m[1], y, _mm256_fmadd_ps(m[2], z, m[3])));
+		__m256 oy = _mm256_fmadd_ps(m[4], x, _mm256_fmadd_ps(m[5], y, _mm256_fmadd_ps(m[6], z, m[7])));
+		__m256 oz = _mm256_fmadd_ps(m[8], x, _mm256_fmadd_ps(m[9], y, _mm256_fmadd_ps(m[10], z, m[11])));
+		storeSoA4(outVerts + i, _mm256_castps256_ps128(ox), _mm256_castps256_ps128(oy), _mm256_castps256_ps128(oz));
+		storeSoA4(outVerts + i + 4, _mm256_extractf128_ps(ox, 1), _mm256_extractf128_ps(oy, 1), _mm256_extractf128_ps(oz, 1));
+
+		x = _mm256_set_m128(nxh, nxl); y = _mm256_set_m128(nyh, nyl); z = _mm256_set_m128(nzh, nzl);
+		ox = _mm256_fmadd_ps(m[0], x, _mm256_fmadd_ps(m[1], y, _mm256_mul_ps(m[2], z)));
+		oy = _mm256_fmadd_ps(m[4], x, _mm256_fmadd_ps(m[5], y, _mm256_mul_ps(m[6], z)));
+		oz = _mm256_fmadd_ps(m[8], x, _mm256_fmadd_ps(m[9], y, _mm256_mul_ps(m[10], z)));
+		storeSoA4(outNormals + i, _mm256_castps256_ps128(ox), _mm256_castps256_ps128(oy), _mm256_castps256_ps128(oz));
+		storeSoA4(outNormals + i + 4, _mm256_extractf128_ps(ox, 1), _mm256_extractf128_ps(oy, 1), _mm256_extractf128_ps(oz, 1));
+	}
+	skinVerticesScalar(table, palette, bind, outVerts, outNormals, i, end);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+bool skinningKernelSupported(SkinningKernel kernel)
+{
+#ifdef SKINNING_X86
+	if (kernel == SKIN_SSE41) return __builtin_cpu_supports("sse4.1");
+	if (kernel == SKIN_AVX2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+	return kernel == SKIN_SCALAR;
+}
+
+// Fastest kernel supported by the CPU we are running on
+SkinningKernel bestSkinningKernel()
+{
+	for (int k = NUM_SKIN_KERNELS - 1; k > 0; k--)
+		if (skinningKernelSupported((SkinningKernel)k)) return (SkinningKernel)k;
+	return SKIN_SCALAR;
+}
+
+// Returns NUM_SKIN_KERNELS if the name is not recognised
+SkinningKernel skinningKernelFromName(const char* name)
+{
+	for (int k = 0; k < NUM_SKIN_KERNELS; k++)
+		if (strcmp(name, skinningKernelNames[k]) == 0) return (SkinningKernel)k;
+	return NUM_SKIN_KERNELS;
+}
+
+// ----------------------------------------------------------------------------
+void skinVertices(SkinningKernel kernel, const SkinTable* table, const aiMatrix4x4* palette, const CompactMesh* bind,
+	aiVector3D* outVerts, aiVector3D* outNormals, int begin, int end)
+{
+#ifdef SKINNING_X86
+	if (kernel == SKIN_AVX2)
+	{
+		skinVerticesAVX2(table, palette, bind, outVerts, outNormals, begin, end);
+		return;
+	}
+	if (kernel == SKIN_SSE41)
+	{
+		skinVerticesSSE41(table, palette, bind, outVerts, outNormals, begin, end);
+		return;
+	}
+#endif
+	skinVerticesScalar(table, palette, bind, outVerts, outNormals, begin, end);
+}
+
+// ----------------------------------------------------------------------------
+void buildSkinChunks(const aiScene* scene, std::vector<SkinChunk>* chunks)
+{
+	chunks->clear();
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		int numVert = scene->mMeshes[m]->mNumVertices;
+		for (int begin = 0; begin < numVert; begin += SKIN_CHUNK_SIZE)
+		{
+			SkinChunk chunk = { (int)m, begin, begin + SKIN_CHUNK_SIZE < numVert ? begin + SKIN_CHUNK_SIZE : numVert };
+			chunks->push_back(chunk);
+		}
+	}
+}
@@ -0,0 +1,405 @@
+// ----------------------------------------------------------------------------
+// Texture pipeline
+//
+// Texture images are identified by a hash of their file contents, so a file
+// shared by several materials or scenes (or copied to another directory) is
+// decoded and uploaded once. A decoded image gets a full mip chain (box
+// filtered on the loader thread) and is stored in texcache/<hash>.tex after
+// its first upload: as DXT5 blocks read back from the driver when S3TC is
+// supported (texcache/<hash>.dxt5.tex), otherwise as plain RGBA mips
+// (texcache/<hash>.rgba.tex). Later runs map the cache file and hand the
+// levels to GL without decoding the image again; DXT5 entries are only used
+// on a driver with S3TC support, elsewhere the image is decoded to RGBA mips.
+//
+// PNG and JPEG files are decoded with libpng and libjpeg, whose decoders keep
+// all state per call, so the loader threads decode them in parallel. Other
+// formats, and files those decoders reject (such as CMYK JPEGs), fall back to
+// DevIL, which is serialised by devilLock.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <csetjmp>
+#include <png.h>
+#include <jpeglib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEXTURE_CACHE_DIR "texcache"
+#define TEXTURE_CACHE_MAGIC "TEXCACH1"
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+struct TextureCacheHeader
+{
+	char magic[8];
+	unsigned long long sourceHash;
+	unsigned int format;    //GL_RGBA or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	unsigned int numLevels; //Followed by numLevels TextureLevel entries, then the data
+};
+
+struct TextureLevel
+{
+	int width, height;
+	unsigned long long offset, size; //Bytes within the level data
+};
+
+struct TextureData
+{
+	unsigned long long hash;
+	GLenum format;
+	std::vector<TextureLevel> levels;
+	const unsigned char* data;          //Level data
+	std::vector<unsigned char> storage; //Owns the data when decoded
+	void* mapping;                      //Owns the data when mapped from the cache
+	size_t mappingSize;
+	bool cached;                        //Already in the disk cache
+
+	TextureData() : hash(0), format(GL_RGBA), data(NULL), mapping(NULL), mappingSize(0), cached(false) {}
+	~TextureData() { if (mapping != NULL) munmap(mapping, mappingSize); }
+};
+
+std::mutex devilLock; //DevIL keeps the bound image in global state and is not thread-safe
+std::mutex textureDataLock;
+std::map<unsigned long long, std::weak_ptr<TextureData> > textureDataByHash; //Images currently loaded
+
+// ----------------------------------------------------------------------------
+// Cache file of an image in the given format (GL_RGBA or DXT5)
+std::string textureCachePath(unsigned long long hash, GLenum format)
+{
+	char name[64];
+	snprintf(name, sizeof(name), TEXTURE_CACHE_DIR "/%016llx.%s.tex", hash, format == GL_RGBA ? "rgba" : "dxt5");
+	return name;
+}
+
+// ----------------------------------------------------------------------------
+// Level 0 is the image itself, every further level a 2x2 box filter of the
+// previous one (edge texels are repeated for odd sizes), down to 1x1.
+void buildMipChain(const unsigned char* rgba, int width, int height, TextureData* tex)
+{
+	tex->format = GL_RGBA;
+	tex->levels.clear();
+	tex->storage.assign(rgba, rgba + (size_t)width * height * 4);
+	TextureLevel level = { width, height, 0, (unsigned long long)width * height * 4 };
+	tex->levels.push_back(level);
+	while (level.width > 1 || level.height > 1)
+	{
+		TextureLevel next = { aisgl_max(level.width / 2, 1), aisgl_max(level.height / 2, 1), tex->storage.size(), 0 };
+		next.size = (unsigned long long)next.width * next.height * 4;
+		tex->storage.resize(tex->storage.size() + next.size);
+		const unsigned char* src = tex->storage.data() + level.offset;
+		unsigned char* dst = tex->storage.data() + next.offset;
+		for (int y = 0; y < next.height; y++)
+		{
+			int y0 = aisgl_min(2 * y, level.height - 1), y1 = aisgl_min(2 * y + 1, level.height - 1);
+			for (int x = 0; x < next.width; x++)
+			{
+				int x0 = aisgl_min(2 * x, level.width - 1), x1 = aisgl_min(2 * x + 1, level.width - 1);
+				for (int c = 0; c < 4; c++)
+				{
+					int sum = src[(y0 * level.width + x0) * 4 + c] + src[(y0 * level.width + x1) * 4 + c]
+						+ src[(y1 * level.width + x0) * 4 + c] + src[(y1 * level.width + x1) * 4 + c];
+					dst[(y * next.width + x) * 4 + c] = (sum + 2) / 4;
+				}
+			}
+		}
+		tex->levels.push_back(next);
+		level = next;
+	}
+	tex->data = tex->storage.data();
+}
+
+// ----------------------------------------------------------------------------
+bool saveTextureCache(const TextureData* tex)
+{
+	mkdir(TEXTURE_CACHE_DIR, 0755);
+	std::string path = textureCachePath(tex->hash, tex->format);
+	std::string tmpPath = path + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	if (fp == NULL) return false;
+	TextureCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TEXTURE_CACHE_MAGIC, 8);
+	header.sourceHash = tex->hash;
+	header.format = tex->format;
+	header.numLevels = tex->levels.size();
+	const TextureLevel& last = tex->levels.back();
+	size_t dataSize = last.offset + last.size;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(tex->levels.data(), sizeof(TextureLevel), tex->levels.size(), fp) == tex->levels.size()
+		&& fwrite(tex->data, 1, dataSize, fp) == dataSize;
+	ok = (fclose(fp) == 0) && ok;
+	if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+	if (!ok) remove(tmpPath.c_str());
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Bytes of one level of the given format
+unsigned long long textureLevelBytes(GLenum format, int width, int height)
+{
+	if (format == GL_RGBA) return (unsigned long long)width * height * 4;
+	return (unsigned long long)((width + 3) / 4) * ((height + 3) / 4) * 16; //4x4 blocks of 16 bytes
+}
+
+// True if the levels form a mip chain of the format: every level halves the
+// previous one (down to 1) and holds exactly the bytes its size needs
+bool validTextureLevels(GLenum format, const TextureLevel* levels, unsigned int numLevels)
+{
+	for (unsigned int i = 0; i < numLevels; i++)
+	{
+		const TextureLevel& level = levels[i];
+		if (level.width < 1 || level.height < 1 || level.size != textureLevelBytes(format, level.width, level.height))
+			return false;
+		if (i > 0 && (level.width != aisgl_max(levels[i - 1].width / 2, 1)
+			|| level.height != aisgl_max(levels[i - 1].height / 2, 1)))
+			return false;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Maps the cache entry of an image in the given format. Entries that don't
+// match their header (stale or corrupt) are rejected, so the image is decoded
+// again.
+bool mapTextureCache(unsigned long long hash, GLenum format, TextureData* tex)
+{
+	int fd = open(textureCachePath(hash, format).c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(TextureCacheHeader))
+		mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+
+	const TextureCacheHeader* header = (const TextureCacheHeader*)mapping;
+	const TextureLevel* levels = (const TextureLevel*)(header + 1);
+	size_t tableEnd = sizeof(TextureCacheHeader) + (size_t)header->numLevels * sizeof(TextureLevel);
+	bool ok = memcmp(header->magic, TEXTURE_CACHE_MAGIC, 8) == 0 && header->sourceHash == hash
+		&& header->numLevels > 0 && header->numLevels <= 32 && tableEnd <= (size_t)st.st_size
+		&& header->format == format;
+	for (unsigned int i = 0; ok && i < header->numLevels; i++)
+		ok = levels[i].offset <= st.st_size - tableEnd && levels[i].size <= st.st_size - tableEnd - levels[i].offset;
+	ok = ok && validTextureLevels(format, levels, header->numLevels);
+	if (!ok)
+	{
+		munmap(mapping, st.st_size);
+		return false;
+	}
+	tex->hash = hash;
+	tex->format = header->format;
+	tex->levels.assign(levels, levels + header->numLevels);
+	tex->data = (const unsigned char*)mapping + tableEnd;
+	tex->mapping = mapping;
+	tex->mappingSize = st.st_size;
+	tex->cached = true;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Rows are stored bottom-up, as DevIL loads them with IL_ORIGIN_LOWER_LEFT
+bool decodePNG(const char* path, TextureData* tex)
+{
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&image, path)) return false;
+	image.format = PNG_FORMAT_RGBA;
+	std::vector<unsigned char> rgba(PNG_IMAGE_SIZE(image));
+	int stride = PNG_IMAGE_ROW_STRIDE(image);
+	//A negative stride makes libpng write the last row first
+	bool ok = png_image_finish_read(&image, NULL, rgba.data(), -stride, NULL) != 0;
+	png_image_free(&image);
+	if (ok) buildMipChain(rgba.data(), image.width, image.height, tex);
+	return ok;
+}
+
+// libjpeg reports errors by longjmp. Everything the decoder changes after the
+// setjmp lives on the heap, in this struct, so its state is well defined when
+// an error jumps back.
+struct JPEGDecoder
+{
+	jpeg_decompress_struct info;
+	jpeg_error_mgr errorMgr;
+	jmp_buf jump;
+	std::vector<unsigned char> rgba, row;
+};
+
+void jpegErrorExit(j_common_ptr info)
+{
+	longjmp(((JPEGDecoder*)info->client_data)->jump, 1);
+}
+
+// Fails for colour spaces libjpeg can't convert to RGB (CMYK, YCCK)
+bool decodeJPEG(const char* path, TextureData* tex)
+{
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) return false;
+	JPEGDecoder* const dec = new JPEGDecoder();
+	dec->info.err = jpeg_std_error(&dec->errorMgr);
+	dec->errorMgr.error_exit = jpegErrorExit;
+	dec->info.client_data = dec; //Kept by jpeg_create_decompress
+	if (setjmp(dec->jump))
+	{
+		jpeg_destroy_decompress(&dec->info);
+		delete dec;
+		fclose(fp);
+		return false;
+	}
+	jpeg_create_decompress(&dec->info);
+	jpeg_stdio_src(&dec->info, fp);
+	jpeg_read_header(&dec->info, TRUE);
+	dec->info.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&dec->info);
+	int width = dec->info.output_width, height = dec->info.output_height;
+	dec->rgba.resize((size_t)width * height * 4);
+	dec->row.resize((size_t)width * 3);
+	while (dec->info.output_scanline < dec->info.output_height)
+	{
+		unsigned char* dst = dec->rgba.data() + (size_t)(height - 1 - dec->info.output_scanline) * width * 4;
+		const unsigned char* src = dec->row.data();
+		JSAMPROW rows[1] = { dec->row.data() };
+		jpeg_read_scanlines(&dec->info, rows, 1);
+		for (int x = 0; x < width; x++)
+		{
+			dst[x * 4] = src[x * 3];
+			dst[x * 4 + 1] = src[x * 3 + 1];
+			dst[x * 4 + 2] = src[x * 3 + 2];
+			dst[x * 4 + 3] = 255;
+		}
+	}
+	jpeg_finish_decompress(&dec->info);
+	jpeg_destroy_decompress(&dec->info);
+	fclose(fp);
+	buildMipChain(dec->rgba.data(), width, height, tex);
+	delete dec;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// PNG and JPEG files (recognised by their signature) are decoded without a
+// lock; anything else, and any file these decoders reject, goes through DevIL
+bool decodeImage(const char* path, TextureData* tex)
+{
+	unsigned char magic[8] = { 0 };
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) return false;
+	size_t n = fread(magic, 1, sizeof(magic), fp);
+	fclose(fp);
+	if (n == sizeof(magic) && png_sig_cmp(magic, 0, sizeof(magic)) == 0 && decodePNG(path, tex)) return true;
+	if (n >= 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF && decodeJPEG(path, tex)) return true;
+
+	std::lock_guard<std::mutex> lock(devilLock);
+	ILuint imageId;
+	ilGenImages(1, &imageId);
+	ilBindImage(imageId); /* Binding of DevIL image name */
+	ilEnable(IL_ORIGIN_SET);
+	ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+	bool ok = ilLoadImage((ILstring)path);
+	if (ok)
+	{
+		/* Convert image to RGBA */
+		ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+		buildMipChain(ilGetData(), ilGetInteger(IL_IMAGE_WIDTH), ilGetInteger(IL_IMAGE_HEIGHT), tex);
+	}
+	ilDeleteImages(1, &imageId);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Decoded (or mapped) mip chain of an image file; called on the loader threads.
+// compressed: the driver supports S3TC, so a DXT5 cache entry can be used.
+// Returns NULL if the image can't be loaded.
+std::shared_ptr<TextureData> loadTextureData(const char* path, bool compressed)
+{
+	unsigned long long hash, size;
+	if (!hashFile(path, &hash, &size)) return std::shared_ptr<TextureData>();
+	{
+		std::lock_guard<std::mutex> lock(textureDataLock);
+		std::shared_ptr<TextureData> shared = textureDataByHash[hash].lock();
+		if (shared) return shared;
+	}
+
+	std::shared_ptr<TextureData> tex = std::make_shared<TextureData>();
+	bool mapped = compressed && mapTextureCache(hash, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, tex.get());
+	if (!mapped && mapTextureCache(hash, GL_RGBA, tex.get()))
+	{
+		mapped = true;
+		tex->cached = !compressed; //RGBA entry written without S3TC: compressed and cached as DXT5 on upload
+	}
+	if (!mapped)
+	{
+		if (!decodeImage(path, tex.get())) return std::shared_ptr<TextureData>();
+		tex->hash = hash;
+	}
+	std::lock_guard<std::mutex> lock(textureDataLock);
+	textureDataByHash[hash] = tex;
+	return tex;
+}
+
+// ----------------------------------------------------------------------------
+// Creates the GL texture of a mip chain (GL thread only). Images that are not
+// in the disk cache yet are compressed by the driver when compress is set,
+// read back and written to the cache.
+GLuint uploadTexture(TextureData* tex, bool compress)
+{
+	GLuint texId;
+	glGenTextures(1, &texId);
+	glBindTexture(GL_TEXTURE_2D, texId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex->levels.size() - 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	GLenum internalFormat = (compress && !tex->cached) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_RGBA;
+	for (unsigned int i = 0; i < tex->levels.size(); i++)
+	{
+		const TextureLevel& level = tex->levels[i];
+		if (tex->format == GL_RGBA)
+			glTexImage2D(GL_TEXTURE_2D, i, internalFormat, level.width, level.height, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, tex->data + level.offset);
+		else
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, tex->format, level.width, level.height, 0, level.size,
+				tex->data + level.offset);
+	}
+	if (tex->cached) return texId;
+
+	//Replace the RGBA levels by the driver's compressed ones before caching
+	GLint compressed = GL_FALSE;
+	if (internalFormat != GL_RGBA)
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	if (compressed)
+	{
+		std::vector<unsigned char> blocks;
+		for (unsigned int i = 0; i < tex->levels.size(); i++)
+		{
+			GLint size = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			tex->levels[i].offset = blocks.size();
+			tex->levels[i].size = size;
+			blocks.resize(blocks.size() + size);
+			glGetCompressedTexImage(GL_TEXTURE_2D, i, blocks.data() + tex->levels[i].offset);
+		}
+		tex->storage.swap(blocks);
+		tex->data = tex->storage.data();
+		tex->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+	tex->cached = saveTextureCache(tex);
+	if (!tex->cached) cout << "Couldn't write texture cache: " << textureCachePath(tex->hash, tex->format) << endl;
+	return texId;
+}
+
+// ----------------------------------------------------------------------------
+size_t textureDataBytes(const TextureData* tex)
+{
+	const TextureLevel& last = tex->levels.back();
+	return last.offset + last.size;
+}
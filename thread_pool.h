@@ -0,0 +1,137 @@
+// ----------------------------------------------------------------------------
+// Persistent worker pool
+//
+// run(numTasks, job) calls job(t) for t = 0..numTasks-1 and returns when all
+// of them have finished. Tasks are dealt round-robin into one queue per
+// thread; a thread takes work from the back of its own queue and, when that
+// is empty, steals from the front of the others. The calling thread takes
+// part as worker 0, so a pool of size 1 runs everything inline.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int numThreads = 1) : queues(numThreads < 1 ? 1 : numThreads),
+		remaining(0), generation(0), quit(false)
+	{
+		for (int i = 1; i < (int)queues.size(); i++)
+			threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < threads.size(); i++) threads[i].join();
+	}
+
+	int size() const { return queues.size(); }
+
+	void run(int numTasks, const std::function<void(int)>& task)
+	{
+		if (numTasks <= 0) return;
+		if (threads.empty())
+		{
+			for (int t = 0; t < numTasks; t++) task(t);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			job = task;
+			remaining = numTasks;
+			for (int t = 0; t < numTasks; t++)
+			{
+				WorkQueue& q = queues[t % queues.size()];
+				std::lock_guard<std::mutex> qlock(q.lock);
+				q.tasks.push_back(t);
+			}
+			generation++;
+		}
+		wake.notify_all();
+		drain(0);
+		std::unique_lock<std::mutex> lock(mtx);
+		done.wait(lock, [this] { return remaining == 0; });
+	}
+
+private:
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<int> tasks;
+	};
+
+	bool popTask(int id, int* task)
+	{
+		{
+			WorkQueue& own = queues[id];
+			std::lock_guard<std::mutex> lock(own.lock);
+			if (!own.tasks.empty())
+			{
+				*task = own.tasks.back();
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+		for (unsigned int i = 1; i < queues.size(); i++)
+		{
+			WorkQueue& victim = queues[(id + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.lock);
+			if (!victim.tasks.empty())
+			{
+				*task = victim.tasks.front();
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void drain(int id)
+	{
+		int t;
+		while (popTask(id, &t))
+		{
+			job(t);
+			if (remaining.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				done.notify_all();
+			}
+		}
+	}
+
+	void workerLoop(int id)
+	{
+		unsigned int seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				wake.wait(lock, [&] { return quit || generation != seen; });
+				if (quit) return;
+				seen = generation;
+			}
+			drain(id);
+		}
+	}
+
+	std::vector<WorkQueue> queues;
+	std::vector<std::thread> threads;
+	std::function<void(int)> job;
+	std::atomic<int> remaining;
+	unsigned int generation;
+	bool quit;
+	std::mutex mtx;
+	std::condition_variable wake, done;
+};